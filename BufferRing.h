@@ -0,0 +1,84 @@
+#ifndef _BUFFER_RING_H
+#define _BUFFER_RING_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <iostream>
+
+const int BUFFER_RING_SIZE = 3; //one buffer being written, one waiting to be drawn and one the GPU draws from
+const GLuint64 BUFFER_RING_WAIT_NS = 1000000; //1ms per glClientWaitSync call, it is retried until the fence signals
+
+//Ring of persistently mapped vertex buffers for data rewritten every frame. Each buffer stays mapped for its whole
+//life, so whoever produces the data writes it straight into memory the GPU reads, with no glBufferData copy or
+//reallocation. The writer does not need a GL context, only the pointer from mapped(k).
+//The GL thread places a fence after the draws that read buffer k and waits on it before handing k back to the
+//writer. Fences are GL calls, so they stay on the GL thread.
+class PersistentBufferRing
+{
+public:
+    //(re)create the buffers with room for capacity bytes each
+    void init(std::size_t capacity){
+        destroy();
+        const GLbitfield flags {GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT};
+        glGenBuffers(BUFFER_RING_SIZE, buffers);
+        for(int k{};k<BUFFER_RING_SIZE;k++){
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[k]);
+            glBufferStorage(GL_ARRAY_BUFFER, capacity, NULL, flags);
+            mappedMemory[k] = glMapBufferRange(GL_ARRAY_BUFFER, 0, capacity, flags);
+            if(mappedMemory[k] == NULL)
+                std::cout << "ERROR FAILED TO MAP PERSISTENT BUFFER" << std::endl;
+        }
+        bytes = capacity;
+    }
+
+    std::size_t capacity() const { return bytes; }
+
+    //memory of buffer k, stays valid until destroy()
+    void* mapped(int k) const { return mappedMemory[k]; }
+
+    unsigned int buffer(int k) const { return buffers[k]; }
+
+    //fence the draws issued so far that read buffer k, replacing its previous fence
+    void fence(int k){
+        if(fences[k] != NULL) glDeleteSync(fences[k]);
+        fences[k] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    //block until the GPU has finished every draw fenced on buffer k, after which k may be written again
+    void wait(int k){
+        if(fences[k] == NULL) return;
+        GLbitfield waitFlags {0};
+        while(true){
+            GLenum result {glClientWaitSync(fences[k], waitFlags, BUFFER_RING_WAIT_NS)};
+            if(result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) break;
+            if(result == GL_WAIT_FAILED){
+                std::cout << "ERROR WAITING FOR BUFFER FENCE FAILED" << std::endl;
+                break;
+            }
+            waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT; //make sure the fence gets submitted before waiting again
+        }
+        glDeleteSync(fences[k]);
+        fences[k] = NULL;
+    }
+
+    //waits for every buffer to be idle, then unmaps and deletes them
+    void destroy(){
+        if(bytes == 0) return;
+        for(int k{};k<BUFFER_RING_SIZE;k++){
+            wait(k);
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[k]);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            mappedMemory[k] = NULL;
+        }
+        glDeleteBuffers(BUFFER_RING_SIZE, buffers);
+        bytes = 0;
+    }
+
+private:
+    unsigned int buffers[BUFFER_RING_SIZE] {};
+    void* mappedMemory[BUFFER_RING_SIZE] {};
+    GLsync fences[BUFFER_RING_SIZE] {};
+    std::size_t bytes {};
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef _FLUID_GRID_H_
+#define _FLUID_GRID_H_
+
+#include "ParticleArrays.h"
+
+enum cellType {WATER, AIR, SOLID};
+
+//Structure of arrays storage for the staggered fluid grid, indexed with GridIndexing (ghost border included).
+//u lives on the left face of each cell, v on the bottom face, density at the centre. Each phase only streams
+//the fields it uses, e.g. the pressure sweeps touch u, v and type but not the transfer weights.
+class FluidGrid {
+public:
+    alignedVector<float> u, v;             //face velocities
+    alignedVector<float> uPrev, vPrev;     //face velocities before makeIncompressible
+    alignedVector<float> uWeight, vWeight; //particle weights summed by the transfer to the grid
+    alignedVector<float> density;          //particle weights summed at the cell centres
+    alignedVector<cellType> type;
+    //cached projection stencil, bit per neighbour that is not solid. Only depends on the solid cells, so it is
+    //rebuilt by Simulation::solidsChanged() when those change instead of on every relaxation sweep.
+    alignedVector<unsigned char> openFaces;
+    static const unsigned char OPEN_LEFT = 1, OPEN_RIGHT = 2, OPEN_BOTTOM = 4, OPEN_TOP = 8;
+    //the same stencil as face weights (1 open, 0 solid) and 1/open face count (0 with no open face), so the
+    //relaxation sweeps multiply instead of decoding the mask per face
+    alignedVector<float> openLeft, openRight, openBottom, openTop, invOpenCount;
+
+    int size() const { return static_cast<int>(type.size()); }
+
+    //n cells of still air
+    void reset(int n){
+        u.assign(n,0.0f);
+        v.assign(n,0.0f);
+        uPrev.assign(n,0.0f);
+        vPrev.assign(n,0.0f);
+        uWeight.assign(n,0.0f);
+        vWeight.assign(n,0.0f);
+        density.assign(n,0.0f);
+        type.assign(n,AIR);
+        openFaces.assign(n,0);
+        openLeft.assign(n,0.0f);
+        openRight.assign(n,0.0f);
+        openBottom.assign(n,0.0f);
+        openTop.assign(n,0.0f);
+        invOpenCount.assign(n,0.0f);
+    }
+
+    //number of open faces for every openFaces mask
+    static float openCount(unsigned char open){
+        static const float counts[16] {0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4};
+        return counts[open];
+    }
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef _GRID_INDEXING_H_
+#define _GRID_INDEXING_H_
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+//Maps 2D grid cell coordinates to the 1D index used by the spatial hash, the fluid grid and particle sorting.
+//Pick the layout at compile time with -DFLUIDSIM_GRID_ORDER=<n>:
+//  0 column major, index = height*x + y (default)
+//  1 Morton (Z order) curve inside square tiles
+//  2 Hilbert curve inside square tiles
+//The curves need power of two sides, so the grid is padded up to whole GRID_CURVE_TILE sized tiles which are
+//stored one after another column by column. Padding cells are never touched by the simulation.
+//Every layout has a GRID_GHOST_CELLS wide border, index() accepts coordinates from -GRID_GHOST_CELLS up to
+//dimensions-1+GRID_GHOST_CELLS so stencils at the edge of the grid can read their neighbours without clamping.
+
+#define FLUIDSIM_GRID_COLUMN_MAJOR 0
+#define FLUIDSIM_GRID_MORTON 1
+#define FLUIDSIM_GRID_HILBERT 2
+
+#ifndef FLUIDSIM_GRID_ORDER
+#define FLUIDSIM_GRID_ORDER FLUIDSIM_GRID_COLUMN_MAJOR
+#endif
+
+const int GRID_CURVE_TILE = 16; //side of the curve tiles, must be a power of two
+const int GRID_GHOST_CELLS = 1;
+
+class GridIndexing {
+public:
+    void init(glm::ivec2 gridDimensions){
+        dimensions = gridDimensions + glm::ivec2(2*GRID_GHOST_CELLS); //stored dimensions, the ghost border included
+#if FLUIDSIM_GRID_ORDER == FLUIDSIM_GRID_COLUMN_MAJOR
+        numCells = dimensions.x*dimensions.y;
+        origin = dimensions.y*GRID_GHOST_CELLS + GRID_GHOST_CELLS;
+#else
+        int tilesX {(dimensions.x+GRID_CURVE_TILE-1)/GRID_CURVE_TILE};
+        int tilesY {(dimensions.y+GRID_CURVE_TILE-1)/GRID_CURVE_TILE};
+        int tileCells {GRID_CURVE_TILE*GRID_CURVE_TILE};
+        numCells = tilesX*tilesY*tileCells;
+#if FLUIDSIM_GRID_ORDER == FLUIDSIM_GRID_MORTON
+        //Morton codes interleave the bits of x and y, so the index splits into a part per axis
+        columnOffset.resize(dimensions.x);
+        rowOffset.resize(dimensions.y);
+        for(int x{};x<dimensions.x;x++)
+            columnOffset[x] = (x/GRID_CURVE_TILE)*tilesY*tileCells + (spreadBits(x%GRID_CURVE_TILE)<<1);
+        for(int y{};y<dimensions.y;y++)
+            rowOffset[y] = (y/GRID_CURVE_TILE)*tileCells + spreadBits(y%GRID_CURVE_TILE);
+#else
+        lookup.resize(dimensions.x*dimensions.y);
+        for(int x{};x<dimensions.x;x++){
+            for(int y{};y<dimensions.y;y++){
+                int tile {(x/GRID_CURVE_TILE)*tilesY + y/GRID_CURVE_TILE};
+                lookup[dimensions.y*x + y] = tile*tileCells + hilbertIndex(x%GRID_CURVE_TILE,y%GRID_CURVE_TILE);
+            }
+        }
+#endif
+#endif
+    }
+
+    //number of indices including padding, size arrays indexed by index() with this
+    int size() const { return numCells; }
+
+    int index(glm::ivec2 coord) const{
+#if FLUIDSIM_GRID_ORDER == FLUIDSIM_GRID_COLUMN_MAJOR
+        return dimensions.y * coord.x + coord.y + origin;
+#elif FLUIDSIM_GRID_ORDER == FLUIDSIM_GRID_MORTON
+        return columnOffset[coord.x+GRID_GHOST_CELLS] + rowOffset[coord.y+GRID_GHOST_CELLS];
+#else
+        return lookup[dimensions.y * (coord.x+GRID_GHOST_CELLS) + coord.y+GRID_GHOST_CELLS];
+#endif
+    }
+
+#if FLUIDSIM_GRID_ORDER == FLUIDSIM_GRID_COLUMN_MAJOR
+    //index = stride()*x + y + origin, for code that computes column major indices itself (SIMD gathers)
+    int stride() const { return dimensions.y; }
+    int originIndex() const { return origin; }
+#endif
+
+private:
+    glm::ivec2 dimensions {};
+    int numCells {};
+    int origin {}; //column major index of cell (0,0)
+    std::vector<int> columnOffset, rowOffset; //Morton
+    std::vector<int> lookup; //Hilbert
+
+    //insert a zero bit above every bit of v
+    static int spreadBits(int v){
+        int result {};
+        for(int bit{};(1<<bit)<=v;bit++)
+            result |= ((v>>bit)&1)<<(2*bit);
+        return result;
+    }
+
+    //distance of (x,y) along the Hilbert curve filling a GRID_CURVE_TILE square
+    static int hilbertIndex(int x, int y){
+        int d {};
+        for(int s{GRID_CURVE_TILE/2};s>0;s/=2){
+            int rx {(x&s)>0}, ry {(y&s)>0};
+            d += s*s*((3*rx)^ry);
+            if(ry==0){ //rotate the quadrant
+                if(rx==1){
+                    x = s-1-x;
+                    y = s-1-y;
+                }
+                int t {x};
+                x = y;
+                y = t;
+            }
+        }
+        return d;
+    }
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef _GRID_TO_PARTICLES_H_
+#define _GRID_TO_PARTICLES_H_
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+
+#include "GridIndexing.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//Grid to particle velocity transfer. Everything the gather reads is a plain per component float array (sample
+//validity, velocity and the velocity before the pressure solve), so each particle only does four loads per
+//array and batches of particles can use hardware gathers.
+//Built with -mavx2 (or -march=native on a machine that has it) and the column major grid layout, 8 particles
+//go through the AVX2 path at once, everything else runs the scalar code which gives the same results.
+
+//the arrays gatherVelocities reads, indexed like the fluid grid. Component 0 is the horizontal velocity sampled
+//on left faces, 1 the vertical velocity sampled on bottom faces.
+struct gatherGrid{
+    glm::ivec2 dimensions;
+    float invSpacing;
+    const GridIndexing *indexing;
+    const float *valid[2];        //1 where the face borders a water or solid cell, 0 between two air cells
+    const float *velocity[2];
+    const float *prevVelocity[2]; //velocity before the pressure solve
+};
+
+//scalar gather of one component for one particle, returns the new particle velocity
+inline float gatherComponent(const gatherGrid &grid, int component, float gx, float gy, float vel, float flipPicRatio){
+    //shift to the staggered sample positions and keep them in bounds, they are then at least 1 so truncating gives the cell
+    gx = glm::clamp(gx-component*0.5f,1.0f,grid.dimensions.x-1.0f);
+    gy = glm::clamp(gy-(1-component)*0.5f,1.0f,grid.dimensions.y-1.0f);
+    int x0 {static_cast<int>(gx)}, y0 {static_cast<int>(gy)};
+    int x1 {x0+1}, y1 {y0+1}; //at most dimensions, inside the ghost border
+    int i0 {grid.indexing->index({x0,y0})}, i1 {grid.indexing->index({x1,y0})};
+    int i2 {grid.indexing->index({x1,y1})}, i3 {grid.indexing->index({x0,y1})};
+    float sx {gx-x0}, sy {gy-y0};
+    float tx {1-sx}, ty {1-sy};
+    const float *valid {grid.valid[component]}, *velocity {grid.velocity[component]}, *prev {grid.prevVelocity[component]};
+    float w0 {tx*ty*valid[i0]}, w1 {sx*ty*valid[i1]}, w2 {sx*sy*valid[i2]}, w3 {tx*sy*valid[i3]};
+    float w {w0 + w1 + w2 + w3};
+    if(w <= 0.0f) return vel;
+    //average out grid velocities
+    float pic {(w0*velocity[i0] + w1*velocity[i1] + w2*velocity[i2] + w3*velocity[i3])/w};
+    float flip {(w0*(velocity[i0]-prev[i0]) + w1*(velocity[i1]-prev[i1]) +
+                 w2*(velocity[i2]-prev[i2]) + w3*(velocity[i3]-prev[i3]))/w + vel};
+    return flipPicRatio*flip + (1.0f-flipPicRatio)*pic;
+}
+
+#if defined(__AVX2__) && FLUIDSIM_GRID_ORDER == FLUIDSIM_GRID_COLUMN_MAJOR
+//gatherComponent for 8 particles
+inline __m256 gatherComponent8(const gatherGrid &grid, int component, __m256 gx, __m256 gy, __m256 vel, float flipPicRatio){
+    const __m256 one {_mm256_set1_ps(1.0f)};
+    gx = _mm256_sub_ps(gx,_mm256_set1_ps(component*0.5f));
+    gy = _mm256_sub_ps(gy,_mm256_set1_ps((1-component)*0.5f));
+    gx = _mm256_min_ps(_mm256_max_ps(gx,one),_mm256_set1_ps(grid.dimensions.x-1.0f));
+    gy = _mm256_min_ps(_mm256_max_ps(gy,one),_mm256_set1_ps(grid.dimensions.y-1.0f));
+    __m256i x0 {_mm256_cvttps_epi32(gx)}, y0 {_mm256_cvttps_epi32(gy)};
+    __m256i x1 {_mm256_add_epi32(x0,_mm256_set1_epi32(1))}, y1 {_mm256_add_epi32(y0,_mm256_set1_epi32(1))};
+    //column major, index = stride*x + y + origin
+    __m256i stride {_mm256_set1_epi32(grid.indexing->stride())}, origin {_mm256_set1_epi32(grid.indexing->originIndex())};
+    __m256i column0 {_mm256_add_epi32(_mm256_mullo_epi32(x0,stride),origin)};
+    __m256i column1 {_mm256_add_epi32(_mm256_mullo_epi32(x1,stride),origin)};
+    __m256i i0 {_mm256_add_epi32(column0,y0)}, i1 {_mm256_add_epi32(column1,y0)};
+    __m256i i2 {_mm256_add_epi32(column1,y1)}, i3 {_mm256_add_epi32(column0,y1)};
+    __m256 sx {_mm256_sub_ps(gx,_mm256_cvtepi32_ps(x0))}, sy {_mm256_sub_ps(gy,_mm256_cvtepi32_ps(y0))};
+    __m256 tx {_mm256_sub_ps(one,sx)}, ty {_mm256_sub_ps(one,sy)};
+    const float *valid {grid.valid[component]}, *velocity {grid.velocity[component]}, *prev {grid.prevVelocity[component]};
+    __m256 w0 {_mm256_mul_ps(_mm256_mul_ps(tx,ty),_mm256_i32gather_ps(valid,i0,4))};
+    __m256 w1 {_mm256_mul_ps(_mm256_mul_ps(sx,ty),_mm256_i32gather_ps(valid,i1,4))};
+    __m256 w2 {_mm256_mul_ps(_mm256_mul_ps(sx,sy),_mm256_i32gather_ps(valid,i2,4))};
+    __m256 w3 {_mm256_mul_ps(_mm256_mul_ps(tx,sy),_mm256_i32gather_ps(valid,i3,4))};
+    __m256 w {_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(w0,w1),w2),w3)};
+    __m256 v0 {_mm256_i32gather_ps(velocity,i0,4)}, v1 {_mm256_i32gather_ps(velocity,i1,4)};
+    __m256 v2 {_mm256_i32gather_ps(velocity,i2,4)}, v3 {_mm256_i32gather_ps(velocity,i3,4)};
+    __m256 d0 {_mm256_sub_ps(v0,_mm256_i32gather_ps(prev,i0,4))}, d1 {_mm256_sub_ps(v1,_mm256_i32gather_ps(prev,i1,4))};
+    __m256 d2 {_mm256_sub_ps(v2,_mm256_i32gather_ps(prev,i2,4))}, d3 {_mm256_sub_ps(v3,_mm256_i32gather_ps(prev,i3,4))};
+    auto weightedSum = [&](__m256 s0, __m256 s1, __m256 s2, __m256 s3){
+        __m256 sum {_mm256_mul_ps(w0,s0)};
+        sum = _mm256_add_ps(sum,_mm256_mul_ps(w1,s1));
+        sum = _mm256_add_ps(sum,_mm256_mul_ps(w2,s2));
+        return _mm256_add_ps(sum,_mm256_mul_ps(w3,s3));
+    };
+    __m256 pic {_mm256_div_ps(weightedSum(v0,v1,v2,v3),w)};
+    __m256 flip {_mm256_add_ps(_mm256_div_ps(weightedSum(d0,d1,d2,d3),w),vel)};
+    __m256 ratio {_mm256_set1_ps(flipPicRatio)};
+    __m256 blended {_mm256_add_ps(_mm256_mul_ps(ratio,flip),_mm256_mul_ps(_mm256_sub_ps(one,ratio),pic))};
+    //particles without any valid sample keep their velocity
+    return _mm256_blendv_ps(vel,blended,_mm256_cmp_ps(w,_mm256_setzero_ps(),_CMP_GT_OQ));
+}
+#endif
+
+//blend the grid velocities into particles [begin,end)
+inline void gatherVelocities(const gatherGrid &grid, const float *x, const float *y, float *vx, float *vy,
+                             int begin, int end, float flipPicRatio){
+    int i {begin};
+#if defined(__AVX2__) && FLUIDSIM_GRID_ORDER == FLUIDSIM_GRID_COLUMN_MAJOR
+    const __m256 invSpacing {_mm256_set1_ps(grid.invSpacing)};
+    for(;i+8<=end;i+=8){
+        __m256 gx {_mm256_mul_ps(_mm256_loadu_ps(x+i),invSpacing)}, gy {_mm256_mul_ps(_mm256_loadu_ps(y+i),invSpacing)};
+        _mm256_storeu_ps(vx+i,gatherComponent8(grid,0,gx,gy,_mm256_loadu_ps(vx+i),flipPicRatio));
+        _mm256_storeu_ps(vy+i,gatherComponent8(grid,1,gx,gy,_mm256_loadu_ps(vy+i),flipPicRatio));
+    }
+#endif
+    for(;i<end;i++){
+        float gx {x[i]*grid.invSpacing}, gy {y[i]*grid.invSpacing};
+        vx[i] = gatherComponent(grid,0,gx,gy,vx[i],flipPicRatio);
+        vy[i] = gatherComponent(grid,1,gx,gy,vy[i],flipPicRatio);
+    }
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef _PARTICLE_ARRAYS_H_
+#define _PARTICLE_ARRAYS_H_
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstddef>
+#include <new>
+
+const std::size_t PARTICLE_ALIGNMENT = 64; //cache line, also enough for AVX-512 loads
+
+//allocator handing out storage aligned to Alignment bytes so particle streams start on a cache line
+template<typename T, std::size_t Alignment>
+struct AlignedAllocator{
+    using value_type = T;
+    template<typename U> struct rebind { using other = AlignedAllocator<U,Alignment>; };
+
+    AlignedAllocator() = default;
+    template<typename U> AlignedAllocator(const AlignedAllocator<U,Alignment>&) {}
+
+    T* allocate(std::size_t n){
+        return static_cast<T*>(::operator new(n*sizeof(T),std::align_val_t{Alignment}));
+    }
+    void deallocate(T* p, std::size_t){
+        ::operator delete(p,std::align_val_t{Alignment});
+    }
+    template<typename U> bool operator==(const AlignedAllocator<U,Alignment>&) const { return true; }
+    template<typename U> bool operator!=(const AlignedAllocator<U,Alignment>&) const { return false; }
+};
+
+template<typename T>
+using alignedVector = std::vector<T,AlignedAllocator<T,PARTICLE_ALIGNMENT>>;
+
+//Structure of arrays particle storage. Each attribute is its own aligned stream so the hot loops
+//only pull the data they use through the cache and can be vectorised.
+class ParticleArrays {
+public:
+    alignedVector<float> x, y;   //positions
+    alignedVector<float> vx, vy; //velocities
+    alignedVector<float> prevX, prevY; //positions before the most recent step, rendering interpolates towards x and y
+    alignedVector<glm::vec3> color;
+
+    ParticleArrays() = default;
+    explicit ParticleArrays(int n) { resize(n); }
+
+    int size() const { return static_cast<int>(x.size()); }
+
+    void resize(int n){
+        x.resize(n);
+        y.resize(n);
+        vx.resize(n);
+        vy.resize(n);
+        prevX.resize(n);
+        prevY.resize(n);
+        color.resize(n);
+    }
+
+    glm::vec2 position(int i) const { return {x[i],y[i]}; }
+    glm::vec2 velocity(int i) const { return {vx[i],vy[i]}; }
+
+    //remember the current positions as the start of the next step
+    void savePositions(){
+        prevX.assign(x.begin(),x.end());
+        prevY.assign(y.begin(),y.end());
+    }
+
+    void setPosition(int i, glm::vec2 pos){
+        x[i] = pos.x;
+        y[i] = pos.y;
+    }
+
+    void setVelocity(int i, glm::vec2 vel){
+        vx[i] = vel.x;
+        vy[i] = vel.y;
+    }
+
+    //reorder so particle k becomes the old particle order[k]. scratch receives the old arrays, passing the
+    //same scratch every time keeps its buffers around so this does not allocate once sizes settle.
+    void permute(const int *order, ParticleArrays &scratch){
+        int n {size()};
+        scratch.resize(n);
+        for(int k{};k<n;k++){
+            int i {order[k]};
+            scratch.x[k] = x[i];
+            scratch.y[k] = y[i];
+            scratch.vx[k] = vx[i];
+            scratch.vy[k] = vy[i];
+            scratch.prevX[k] = prevX[i];
+            scratch.prevY[k] = prevY[i];
+            scratch.color[k] = color[i];
+        }
+        x.swap(scratch.x);
+        y.swap(scratch.y);
+        vx.swap(scratch.vx);
+        vy.swap(scratch.vy);
+        prevX.swap(scratch.prevX);
+        prevY.swap(scratch.prevY);
+        color.swap(scratch.color);
+    }
+};
+
+#endif
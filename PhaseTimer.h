@@ -0,0 +1,96 @@
+#ifndef _PHASE_TIMER_H_
+#define _PHASE_TIMER_H_
+
+#include <array>
+#include <chrono>
+#include <algorithm>
+
+//Per-phase wall time of Simulation::simulate. Timers only exist when built with -DFLUIDSIM_PROFILE,
+//otherwise PHASE_TIMER expands to nothing and the stats stay empty.
+
+enum simPhase {PHASE_STEP, PHASE_INTEGRATE, PHASE_PUSH_APART, PHASE_HANDLE_OBSTACLES, PHASE_TRANSFER_TO_GRID,
+               PHASE_MAKE_INCOMPRESSIBLE, PHASE_TRANSFER_TO_PARTICLES, PHASE_COLOR_PARTICLES,
+               NUM_PHASES};
+
+const char* const PHASE_NAMES[NUM_PHASES] = {"step", "integrate", "pushApart", "handleObstacles", "transferToGrid",
+                                             "makeIncompressible", "transferToParticles", "colorParticles"};
+
+const int PHASE_TIMER_WINDOW = 256; //number of most recent samples kept per phase
+
+struct phaseStats{
+    float min;  //milliseconds
+    float mean;
+    float p99;
+    int samples;
+};
+
+class PhaseTimings {
+public:
+    static constexpr bool enabled(){
+#ifdef FLUIDSIM_PROFILE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void record(simPhase phase, float ms){
+        window[phase][next[phase]] = ms;
+        next[phase] = (next[phase]+1)%PHASE_TIMER_WINDOW;
+        count[phase] = std::min(count[phase]+1,PHASE_TIMER_WINDOW);
+    }
+
+    //min/mean/p99 over the rolling window, all zero if nothing was recorded
+    phaseStats stats(simPhase phase) const{
+        int n {count[phase]};
+        if(n==0) return {0.0f,0.0f,0.0f,0};
+        std::array<float,PHASE_TIMER_WINDOW> sorted;
+        std::copy(window[phase].begin(),window[phase].begin()+n,sorted.begin());
+        int p99Index {(99*(n-1))/100};
+        std::nth_element(sorted.begin(),sorted.begin()+p99Index,sorted.begin()+n);
+        float p99 {sorted[p99Index]};
+        float sum {}, min {sorted[0]};
+        for(int i{};i<n;i++){
+            sum += sorted[i];
+            min = std::min(min,sorted[i]);
+        }
+        return {min,sum/n,p99,n};
+    }
+
+    void reset(){
+        next.fill(0);
+        count.fill(0);
+    }
+
+private:
+    std::array<std::array<float,PHASE_TIMER_WINDOW>,NUM_PHASES> window {};
+    std::array<int,NUM_PHASES> next {};
+    std::array<int,NUM_PHASES> count {};
+};
+
+//records the time between construction and destruction
+class ScopedPhaseTimer {
+public:
+    ScopedPhaseTimer(PhaseTimings &timings, simPhase phase) : timings(timings), phase(phase), start(std::chrono::steady_clock::now()) {}
+    ~ScopedPhaseTimer(){
+        timings.record(phase,std::chrono::duration<float,std::milli>(std::chrono::steady_clock::now()-start).count());
+    }
+    ScopedPhaseTimer(const ScopedPhaseTimer&) = delete;
+    ScopedPhaseTimer& operator=(const ScopedPhaseTimer&) = delete;
+
+private:
+    PhaseTimings &timings;
+    simPhase phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+#define PHASE_TIMER_CONCAT_(a,b) a##b
+#define PHASE_TIMER_CONCAT(a,b) PHASE_TIMER_CONCAT_(a,b)
+
+#ifdef FLUIDSIM_PROFILE
+#define PHASE_TIMER(timings,phase) ScopedPhaseTimer PHASE_TIMER_CONCAT(phaseTimer,__LINE__) {timings,phase}
+#else
+#define PHASE_TIMER(timings,phase)
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef _PRESSURE_RELAX_H_
+#define _PRESSURE_RELAX_H_
+
+#include <algorithm>
+
+#include "ParticleArrays.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//Red black half sweeps of the pressure relaxation. Cells of one checkerboard colour share no faces, so a half sweep
+//can first compute the correction of every cell from the current face velocities and then apply them all, which
+//gives exactly what relaxing the cells one by one does. The cells are kept as flat index streams per colour so the
+//first pass reads them contiguously: built with -mavx2 (or -march=native on a machine that has it) it does 8 cells
+//at once with hardware gathers, otherwise the scalar loop gives the same results. Applying the corrections stays
+//scalar, AVX2 has no scatter.
+
+//one colour's water cells, as fluid grid indices of the cell and of its right and top neighbours
+struct relaxColourCells{
+    alignedVector<int> centre, right, top;
+
+    int size() const { return static_cast<int>(centre.size()); }
+
+    void clear(){
+        centre.clear();
+        right.clear();
+        top.clear();
+    }
+
+    void push(int c, int r, int t){
+        centre.push_back(c);
+        right.push_back(r);
+        top.push_back(t);
+    }
+};
+
+//the fluid grid fields and parameters a half sweep uses, see FluidGrid.h
+struct relaxGrid{
+    float *u, *v, *pressure;
+    const float *density;
+    const float *openLeft, *openRight, *openBottom, *openTop, *invOpenCount;
+    float restDensity, overrelax, compressionFactor;
+};
+
+//delta[k] = (overrelax*divergence - compressionFactor*max(density-restDensity,0)) * invOpenCount for cells [begin,end)
+inline void relaxCorrections(const relaxGrid &grid, const relaxColourCells &cells, int begin, int end, float *delta){
+    const int *centre {cells.centre.data()}, *right {cells.right.data()}, *top {cells.top.data()};
+    int k {begin};
+#if defined(__AVX2__)
+    const __m256 overrelax {_mm256_set1_ps(grid.overrelax)}, compressionFactor {_mm256_set1_ps(grid.compressionFactor)};
+    const __m256 restDensity {_mm256_set1_ps(grid.restDensity)}, zero {_mm256_setzero_ps()};
+    for(;k+8<=end;k+=8){
+        __m256i c {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(centre+k))};
+        __m256i r {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(right+k))};
+        __m256i t {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(top+k))};
+        __m256 div {_mm256_sub_ps(_mm256_i32gather_ps(grid.u,r,4),_mm256_i32gather_ps(grid.u,c,4))};
+        div = _mm256_add_ps(div,_mm256_i32gather_ps(grid.v,t,4));
+        div = _mm256_sub_ps(div,_mm256_i32gather_ps(grid.v,c,4));
+        div = _mm256_mul_ps(div,overrelax);
+        __m256 compression {_mm256_sub_ps(_mm256_i32gather_ps(grid.density,c,4),restDensity)};
+        div = _mm256_sub_ps(div,_mm256_mul_ps(compressionFactor,_mm256_max_ps(compression,zero)));
+        div = _mm256_mul_ps(div,_mm256_i32gather_ps(grid.invOpenCount,c,4));
+        _mm256_storeu_ps(delta+k,div);
+    }
+#endif
+    for(;k<end;k++){
+        int c {centre[k]};
+        float div {grid.u[right[k]] - grid.u[c] + grid.v[top[k]] - grid.v[c]};
+        div *= grid.overrelax;
+        div -= grid.compressionFactor*std::max(grid.density[c]-grid.restDensity,0.0f);
+        delta[k] = div*grid.invOpenCount[c];
+    }
+}
+
+//subtract the corrections from the pressure and move the open faces of cells [begin,end) by them
+inline void applyRelaxCorrections(const relaxGrid &grid, const relaxColourCells &cells, int begin, int end, const float *delta){
+    const int *centre {cells.centre.data()}, *right {cells.right.data()}, *top {cells.top.data()};
+    for(int k{begin};k<end;k++){
+        int c {centre[k]};
+        float d {delta[k]};
+        grid.pressure[c] -= d;
+        grid.u[c] += d*grid.openLeft[c];
+        grid.u[right[k]] -= d*grid.openRight[c];
+        grid.v[c] += d*grid.openBottom[c];
+        grid.v[top[k]] -= d*grid.openTop[c];
+    }
+}
+
+#endif
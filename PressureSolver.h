@@ -0,0 +1,438 @@
+#ifndef _PRESSURE_SOLVER_H_
+#define _PRESSURE_SOLVER_H_
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "GridIndexing.h"
+#include "FluidGrid.h"
+
+//Pressure Poisson equation on the water cells of the fluid grid, in cell units:
+//  sum over non solid neighbours n of (p_c - p_n) = rhs_c
+//Air cells hold zero pressure, solid neighbours drop out of the sum. Setting the face velocities to
+//u -= p_c - p_left (and likewise for v) then changes the divergence of every water cell by exactly rhs.
+struct poissonProblem{
+    glm::ivec2 dimensions;
+    const GridIndexing *indexing;
+    const cellType *types; //indexed with indexing
+    const unsigned char *openFaces; //FluidGrid::openFaces, the cached non solid neighbours of each cell
+    const float *rhs;      //only read on water cells
+    const glm::ivec2 *waterCells; //coordinates of every interior water cell in lexicographic (i then j) order
+    int numWaterCells;
+};
+
+struct pressureSolveResult{
+    int iterations;
+    float residual; //max |rhs - A p| over the water cells when the solve stopped
+};
+
+//Conjugate gradients preconditioned with modified incomplete Cholesky, MIC(0), see Bridson's
+//"Fluid Simulation for Computer Graphics". Work vectors are kept between solves.
+class PCGSolver {
+public:
+    //pressure holds the initial guess on entry and the solution on exit, non water entries are left alone
+    pressureSolveResult solve(const poissonProblem &problem, float *pressure, float tolerance, int maxIters){
+        setup(problem);
+
+        //r = b - A p
+        applyLaplacian(pressure,product.data());
+        float maxResidual {};
+        for(int c:waterCells){
+            residual[c] = problem.rhs[c] - product[c];
+            maxResidual = std::max(maxResidual,std::abs(residual[c]));
+        }
+        if(maxResidual <= tolerance) return {0,maxResidual};
+
+        applyPreconditioner(residual.data(),aux.data());
+        for(int c:waterCells) search[c] = aux[c];
+        double sigma {dot(aux.data(),residual.data())};
+
+        int iter {};
+        while(iter<maxIters){
+            iter++;
+            applyLaplacian(search.data(),product.data());
+            double sp {dot(search.data(),product.data())};
+            if(sp <= 0.0) break;
+            float alpha {static_cast<float>(sigma/sp)};
+            maxResidual = 0.0f;
+            for(int c:waterCells){
+                pressure[c] += alpha*search[c];
+                residual[c] -= alpha*product[c];
+                maxResidual = std::max(maxResidual,std::abs(residual[c]));
+            }
+            if(maxResidual <= tolerance) break;
+
+            applyPreconditioner(residual.data(),aux.data());
+            double sigmaNew {dot(aux.data(),residual.data())};
+            float beta {static_cast<float>(sigmaNew/sigma)};
+            for(int c:waterCells) search[c] = aux[c] + beta*search[c];
+            sigma = sigmaNew;
+        }
+        return {iter,maxResidual};
+    }
+
+private:
+    static constexpr float MIC_TUNING = 0.97f; //tau, how much of the dropped fill in goes back on the diagonal
+    static constexpr float MIC_SAFETY = 0.25f; //sigma, fall back to the plain diagonal when the factor gets this small
+
+    //bits of waterNeighbours
+    static const unsigned char LEFT_WATER = 1, RIGHT_WATER = 2, BOTTOM_WATER = 4, TOP_WATER = 8;
+
+    std::vector<int> waterCells; //water cell indices in lexicographic (i then j) order
+    std::vector<int> leftIndex, rightIndex, bottomIndex, topIndex;
+    std::vector<unsigned char> waterNeighbours; //which neighbours carry an unknown
+    std::vector<float> diagonal, precon, residual, aux, search, product;
+
+    void setup(const poissonProblem &problem){
+        const GridIndexing &indexing {*problem.indexing};
+        const cellType *types {problem.types};
+        int n {indexing.size()};
+        if(static_cast<int>(diagonal.size()) != n){
+            for(auto *v: {&diagonal,&precon,&residual,&aux,&search,&product})
+                v->assign(n,0.0f);
+            for(auto *v: {&leftIndex,&rightIndex,&bottomIndex,&topIndex})
+                v->assign(n,0);
+            waterNeighbours.assign(n,0);
+        }
+        waterCells.clear();
+        for(int k{};k<problem.numWaterCells;k++){
+            int i {problem.waterCells[k].x}, j {problem.waterCells[k].y};
+            int c {indexing.index({i,j})};
+            int left {indexing.index({i-1,j})}, right {indexing.index({i+1,j})};
+            int bottom {indexing.index({i,j-1})}, top {indexing.index({i,j+1})};
+            leftIndex[c] = left;
+            rightIndex[c] = right;
+            bottomIndex[c] = bottom;
+            topIndex[c] = top;
+            diagonal[c] = FluidGrid::openCount(problem.openFaces[c]);
+            waterNeighbours[c] = (types[left]==WATER?LEFT_WATER:0) | (types[right]==WATER?RIGHT_WATER:0) |
+                                 (types[bottom]==WATER?BOTTOM_WATER:0) | (types[top]==WATER?TOP_WATER:0);
+            waterCells.push_back(c);
+        }
+
+        //MIC(0) factor. Left and bottom neighbours come earlier in waterCells so their entries are final.
+        for(int c:waterCells){
+            float e {diagonal[c]};
+            if(waterNeighbours[c] & LEFT_WATER){
+                float pl {precon[leftIndex[c]]};
+                e -= pl*pl*(1.0f + ((waterNeighbours[leftIndex[c]] & TOP_WATER)?MIC_TUNING:0.0f));
+            }
+            if(waterNeighbours[c] & BOTTOM_WATER){
+                float pb {precon[bottomIndex[c]]};
+                e -= pb*pb*(1.0f + ((waterNeighbours[bottomIndex[c]] & RIGHT_WATER)?MIC_TUNING:0.0f));
+            }
+            if(e < MIC_SAFETY*diagonal[c]) e = diagonal[c];
+            precon[c] = e>0.0f ? 1.0f/std::sqrt(e) : 0.0f;
+        }
+    }
+
+    //out = A x on the water cells
+    void applyLaplacian(const float *x, float *out) const{
+        for(int c:waterCells){
+            unsigned char w {waterNeighbours[c]};
+            float sum {diagonal[c]*x[c]};
+            if(w & LEFT_WATER) sum -= x[leftIndex[c]];
+            if(w & RIGHT_WATER) sum -= x[rightIndex[c]];
+            if(w & BOTTOM_WATER) sum -= x[bottomIndex[c]];
+            if(w & TOP_WATER) sum -= x[topIndex[c]];
+            out[c] = sum;
+        }
+    }
+
+    //z = M^-1 r by forward then backward substitution with the MIC factor
+    void applyPreconditioner(const float *r, float *z) const{
+        for(int c:waterCells){
+            unsigned char w {waterNeighbours[c]};
+            float t {r[c]};
+            if(w & LEFT_WATER) t += precon[leftIndex[c]]*z[leftIndex[c]];
+            if(w & BOTTOM_WATER) t += precon[bottomIndex[c]]*z[bottomIndex[c]];
+            z[c] = t*precon[c];
+        }
+        for(auto it = waterCells.rbegin();it!=waterCells.rend();++it){
+            int c {*it};
+            unsigned char w {waterNeighbours[c]};
+            float t {z[c]};
+            if(w & RIGHT_WATER) t += precon[c]*z[rightIndex[c]];
+            if(w & TOP_WATER) t += precon[c]*z[topIndex[c]];
+            z[c] = t*precon[c];
+        }
+    }
+
+    double dot(const float *a, const float *b) const{
+        double sum {};
+        for(int c:waterCells) sum += static_cast<double>(a[c])*b[c];
+        return sum;
+    }
+};
+
+//Geometric multigrid for the same equation, used as the preconditioner of conjugate gradients (MGPCG, after
+//McAdams et al. "A parallel multigrid Poisson solver for fluids simulation on large grids"). Plain V-cycles
+//stall at the free surface where coarse cells mix water and air, wrapping them in CG keeps the iteration count
+//about constant as the grid grows so the solve cost stays near linear in the number of cells.
+//Each coarser level halves the grid. A coarse cell is air if any child is air, else water if any child is
+//water, else solid, and the operator is rediscretised from those types. Red-black Gauss-Seidel smooths every
+//level (reversed colour order after the coarse correction so the cycle is symmetric), restriction sums the
+//child residuals and prolongation copies the coarse correction back onto the water children.
+//Levels use their own column major storage.
+class MultigridSolver {
+public:
+    //pressure holds the initial guess on entry and the solution on exit, non water entries are left alone
+    pressureSolveResult solve(const poissonProblem &problem, float *pressure, float tolerance, int maxIters){
+        build(problem);
+        level &fine {levels.front()};
+        const GridIndexing &indexing {*problem.indexing};
+        int n {static_cast<int>(fine.types.size())};
+        waterCells.clear();
+        for(int i{};i<fine.dimensions.x;i++){
+            for(int j{};j<fine.dimensions.y;j++){
+                int c {indexing.index({i,j})}, l {fine.index(i,j)};
+                bool water {fine.types[l]==WATER};
+                rhs[l] = water ? problem.rhs[c] : 0.0f;
+                solution[l] = water ? pressure[c] : 0.0f;
+                if(water) waterCells.push_back(l);
+            }
+        }
+        std::fill(search.begin(),search.begin()+n,0.0f);
+
+        //r = b - A x
+        applyLaplacian(fine,solution.data(),product.data());
+        float maxResidual {};
+        for(int c:waterCells){
+            residual[c] = rhs[c] - product[c];
+            maxResidual = std::max(maxResidual,std::abs(residual[c]));
+        }
+        int iter {};
+        if(maxResidual > tolerance){
+            precondition();
+            for(int c:waterCells) search[c] = fine.x[c];
+            double sigma {dot(fine.x.data(),residual.data())};
+            while(iter<maxIters){
+                iter++;
+                applyLaplacian(fine,search.data(),product.data());
+                double sp {dot(search.data(),product.data())};
+                if(sp <= 0.0) break;
+                float alpha {static_cast<float>(sigma/sp)};
+                maxResidual = 0.0f;
+                for(int c:waterCells){
+                    solution[c] += alpha*search[c];
+                    residual[c] -= alpha*product[c];
+                    maxResidual = std::max(maxResidual,std::abs(residual[c]));
+                }
+                if(maxResidual <= tolerance) break;
+
+                precondition();
+                double sigmaNew {dot(fine.x.data(),residual.data())};
+                float beta {static_cast<float>(sigmaNew/sigma)};
+                for(int c:waterCells) search[c] = fine.x[c] + beta*search[c];
+                sigma = sigmaNew;
+            }
+        }
+
+        for(int i{};i<fine.dimensions.x;i++){
+            for(int j{};j<fine.dimensions.y;j++){
+                int l {fine.index(i,j)};
+                if(fine.types[l]==WATER) pressure[indexing.index({i,j})] = solution[l];
+            }
+        }
+        return {iter,maxResidual};
+    }
+
+private:
+    static const int PRE_SMOOTH = 2, POST_SMOOTH = 2;
+    static const int COARSEST_SWEEPS = 20; //symmetric sweep pairs standing in for an exact solve on the coarsest level
+    static const int COARSEST_SIZE = 4;    //stop coarsening once a side is this small
+
+    static const unsigned char LEFT_WATER = 1, RIGHT_WATER = 2, BOTTOM_WATER = 4, TOP_WATER = 8;
+
+    struct level{
+        glm::ivec2 dimensions {};
+        std::vector<cellType> types;
+        std::vector<float> diagonal; //non solid neighbour count of each water cell
+        std::vector<unsigned char> waterNeighbours; //which neighbours of each water cell are water
+        std::vector<float> x, b, r;
+        int index(int i, int j) const { return dimensions.y*i + j; }
+        bool inside(int i, int j) const { return i>=0 && j>=0 && i<dimensions.x && j<dimensions.y; }
+        cellType typeAt(int i, int j) const { return inside(i,j) ? types[index(i,j)] : SOLID; }
+    };
+    std::vector<level> levels;
+    std::vector<int> waterCells; //fine level water cells
+    std::vector<float> rhs, solution, residual, search, product; //fine level CG vectors
+
+    void build(const poissonProblem &problem){
+        if(levels.empty() || levels.front().dimensions != problem.dimensions){
+            levels.clear();
+            glm::ivec2 dims {problem.dimensions};
+            for(;;){
+                level lvl;
+                lvl.dimensions = dims;
+                int n {dims.x*dims.y};
+                lvl.types.assign(n,SOLID);
+                lvl.diagonal.assign(n,0.0f);
+                lvl.waterNeighbours.assign(n,0);
+                lvl.x.assign(n,0.0f);
+                lvl.b.assign(n,0.0f);
+                lvl.r.assign(n,0.0f);
+                levels.push_back(std::move(lvl));
+                if(std::min(dims.x,dims.y) <= COARSEST_SIZE) break;
+                dims = {(dims.x+1)/2,(dims.y+1)/2};
+            }
+            int n {problem.dimensions.x*problem.dimensions.y};
+            for(auto *v: {&rhs,&solution,&residual,&search,&product})
+                v->assign(n,0.0f);
+        }
+        level &fine {levels.front()};
+        for(int i{};i<fine.dimensions.x;i++){
+            for(int j{};j<fine.dimensions.y;j++){
+                fine.types[fine.index(i,j)] = problem.types[problem.indexing->index({i,j})];
+            }
+        }
+        for(size_t l{1};l<levels.size();l++){
+            level &parent {levels[l-1]}, &coarse {levels[l]};
+            for(int i{};i<coarse.dimensions.x;i++){
+                for(int j{};j<coarse.dimensions.y;j++){
+                    bool anyWater {false}, anyAir {false};
+                    for(int ci{2*i};ci<2*i+2;ci++){
+                        for(int cj{2*j};cj<2*j+2;cj++){
+                            cellType t {parent.typeAt(ci,cj)};
+                            anyWater = anyWater || t==WATER;
+                            anyAir = anyAir || t==AIR;
+                        }
+                    }
+                    coarse.types[coarse.index(i,j)] = anyAir ? AIR : (anyWater ? WATER : SOLID);
+                }
+            }
+        }
+        //the fine level takes its diagonal from the cached stencil, coarse levels rediscretise it from their types
+        for(size_t l{};l<levels.size();l++){
+            level &lvl {levels[l]};
+            for(int i{};i<lvl.dimensions.x;i++){
+                for(int j{};j<lvl.dimensions.y;j++){
+                    int c {lvl.index(i,j)};
+                    cellType left {lvl.typeAt(i-1,j)}, right {lvl.typeAt(i+1,j)};
+                    cellType bottom {lvl.typeAt(i,j-1)}, top {lvl.typeAt(i,j+1)};
+                    if(l == 0)
+                        lvl.diagonal[c] = FluidGrid::openCount(problem.openFaces[problem.indexing->index({i,j})]);
+                    else
+                        lvl.diagonal[c] = (left!=SOLID) + (right!=SOLID) + (bottom!=SOLID) + (top!=SOLID);
+                    lvl.waterNeighbours[c] = (left==WATER?LEFT_WATER:0) | (right==WATER?RIGHT_WATER:0) |
+                                             (bottom==WATER?BOTTOM_WATER:0) | (top==WATER?TOP_WATER:0);
+                }
+            }
+        }
+    }
+
+    //levels[0].x = V-cycle applied to the current CG residual, starting from zero
+    void precondition(){
+        level &fine {levels.front()};
+        for(size_t c{};c<fine.b.size();c++){
+            fine.b[c] = fine.types[c]==WATER ? residual[c] : 0.0f;
+            fine.x[c] = 0.0f;
+        }
+        vCycle(0);
+    }
+
+    void vCycle(int l){
+        level &lvl {levels[l]};
+        if(l+1 == static_cast<int>(levels.size())){
+            for(int sweep{};sweep<COARSEST_SWEEPS;sweep++){
+                smooth(lvl,1,false);
+                smooth(lvl,1,true);
+            }
+            return;
+        }
+        smooth(lvl,PRE_SMOOTH,false);
+        computeResidual(lvl);
+
+        //restrict: the coarse right hand side is the summed child residual. The Galerkin coarse operator of piecewise
+        //constant interpolation is twice the rediscretised one, so the Galerkin consistent right hand side would be
+        //half that sum, but piecewise constant prolongation undershoots the smooth error by about the same factor.
+        //Leaving it unscaled keeps the V-cycle symmetric and needs 2-3x fewer CG iterations, flat as the grid grows.
+        level &coarse {levels[l+1]};
+        for(int i{};i<coarse.dimensions.x;i++){
+            for(int j{};j<coarse.dimensions.y;j++){
+                int c {coarse.index(i,j)};
+                coarse.x[c] = 0.0f;
+                float sum {};
+                if(coarse.types[c]==WATER){
+                    for(int ci{2*i};ci<std::min(2*i+2,lvl.dimensions.x);ci++){
+                        for(int cj{2*j};cj<std::min(2*j+2,lvl.dimensions.y);cj++){
+                            sum += lvl.r[lvl.index(ci,cj)];
+                        }
+                    }
+                }
+                coarse.b[c] = sum;
+            }
+        }
+        vCycle(l+1);
+
+        //prolong the correction onto the water cells
+        for(int i{};i<lvl.dimensions.x;i++){
+            for(int j{};j<lvl.dimensions.y;j++){
+                int c {lvl.index(i,j)};
+                if(lvl.types[c]==WATER) lvl.x[c] += coarse.x[coarse.index(i/2,j/2)];
+            }
+        }
+        smooth(lvl,POST_SMOOTH,true);
+    }
+
+    //red-black Gauss-Seidel, x_c = (b_c + sum of water neighbours) / non solid neighbour count.
+    //reversed runs black before red so a pre and post smooth pair stays symmetric.
+    void smooth(level &lvl, int sweeps, bool reversed){
+        for(int sweep{};sweep<sweeps;sweep++){
+            for(int k{};k<2;k++){
+                int colour {reversed ? 1-k : k};
+                for(int i{};i<lvl.dimensions.x;i++){
+                    for(int j{(i+colour)%2};j<lvl.dimensions.y;j+=2){
+                        int c {lvl.index(i,j)};
+                        if(lvl.types[c]!=WATER || lvl.diagonal[c]==0.0f) continue;
+                        lvl.x[c] = (lvl.b[c] + neighbourSum(lvl,lvl.x.data(),c))/lvl.diagonal[c];
+                    }
+                }
+            }
+        }
+    }
+
+    //x summed over the water neighbours of cell c
+    static float neighbourSum(const level &lvl, const float *x, int c){
+        unsigned char w {lvl.waterNeighbours[c]};
+        int column {lvl.dimensions.y};
+        float sum {};
+        if(w & LEFT_WATER) sum += x[c-column];
+        if(w & RIGHT_WATER) sum += x[c+column];
+        if(w & BOTTOM_WATER) sum += x[c-1];
+        if(w & TOP_WATER) sum += x[c+1];
+        return sum;
+    }
+
+    //lvl.r = b - A x on water cells
+    void computeResidual(level &lvl){
+        for(int i{};i<lvl.dimensions.x;i++){
+            for(int j{};j<lvl.dimensions.y;j++){
+                int c {lvl.index(i,j)};
+                if(lvl.types[c]!=WATER){
+                    lvl.r[c] = 0.0f;
+                    continue;
+                }
+                lvl.r[c] = lvl.b[c] - (lvl.diagonal[c]*lvl.x[c] - neighbourSum(lvl,lvl.x.data(),c));
+            }
+        }
+    }
+
+    //out = A x on the fine water cells
+    void applyLaplacian(const level &fine, const float *x, float *out) const{
+        for(int c:waterCells){
+            out[c] = fine.diagonal[c]*x[c] - neighbourSum(fine,x,c);
+        }
+    }
+
+    double dot(const float *a, const float *b) const{
+        double sum {};
+        for(int c:waterCells) sum += static_cast<double>(a[c])*b[c];
+        return sum;
+    }
+};
+
+#endif
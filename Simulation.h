@@ -10,34 +10,22 @@
 #include <iostream>
 #include <algorithm>
 
-const unsigned int NUM_PARTICLES = 7000;
-const glm::vec2 GRID_DIMENSIONS = glm::vec2(200,80);
-const float SPACING = 1.1f;
-const float GRAVITY = -9.81f;
-const int NUM_ITERS = 2; //number of iterations to repeat pushApart
-const float FLIP_PIC_RATIO = 0.7f;
-const float OVERRELAX = 1.9f;
-const float COMPRESSION_FACTOR = 5.0f;
-const float MOUSE_OBSTACLE_RADIUS = 7.0f;
-const float TIME_SCALE = 1.5f;
-const glm::vec3 WATER_COLOR = {0.0f,0.2f,0.9f};
-
-
-struct Particle{
-    glm::vec2 position;
-    glm::vec2 velocity;
-    glm::vec3 color = WATER_COLOR;
-};
+#include "PhaseTimer.h"
+#include "ParticleArrays.h"
+#include "ThreadPool.h"
+#include "SpatialHash.h"
+#include "GridIndexing.h"
+#include "PressureSolver.h"
+#include "GridToParticles.h"
+#include "PressureRelax.h"
+#include "FluidGrid.h"
+#include "SimulationConfig.h" //sizes and tuning constants
 
-enum cellType {WATER, AIR, SOLID};
-
-struct fluidCell{
-    glm::vec2 prevVelocity;
-    glm::vec2 velocity;
-    glm::vec2 weights;
-    float density;
-    cellType type {AIR};
-};
+const glm::vec3 WATER_COLOR = {0.0f,0.2f,0.9f};
+const int PUSH_APART_TILE_SIZE = 8; //cells per side of the tiles pushApart hands to threads, must be at least 2
+const int TRANSFER_STRIP_WIDTH = 8; //grid columns per strip in the parallel particle to grid transfer, must be at least 3
+const int GATHER_BLOCK_SIZE = 2048; //particles per job in the parallel grid to particle transfer
+const int RELAX_GRAIN = 256; //water cells per job in the red black pressure sweeps, a multiple of 8 keeps the AVX2 path busy
 
 struct ballObstacle{
     glm::vec2 position;
@@ -48,335 +36,674 @@ struct ballObstacle{
 };
 
 class Simulation {
+private:
+    ThreadPool threadPool; //declared first so it outlives everything that runs on it
+
 public:
-    glm::ivec2 gridDimensions = GRID_DIMENSIONS;
-    float gravity = GRAVITY;
-    std::vector<Particle> particles;
+    SimulationConfig config; //sizes and tuning, change sizes through configure()
+    glm::ivec2 gridDimensions {}; //config.gridDimensions as of the last configure()
+    ParticleArrays particles; //structure of arrays, see ParticleArrays.h
     ballObstacle mouseObstacle{{50.0f,70.0f},{0.0f,0.0f},MOUSE_OBSTACLE_RADIUS,{50.0f,70.0f}, {1.0f,1.0f,0.0f}}; //mouse controls a ball where particles will be pushed away.
+    PhaseTimings phaseTimings; //wall time of each phase of simulate(), only filled when built with FLUIDSIM_PROFILE
+    pressureSolveResult lastPressureSolve {}; //iterations and largest divergence error left by the most recent pressure solve
+    int lastSubsteps {}; //substeps the most recent step was split into
 
-    Simulation() : particles(NUM_PARTICLES), grid(gridDimensions.x*gridDimensions.y + 1,0), particleIDs(NUM_PARTICLES,0), 
-                   fluidGrid(gridDimensions.x*gridDimensions.y)
+    explicit Simulation(const SimulationConfig &simConfig = {}) : threadPool(simConfig.numThreads), config(simConfig)
     {
+        configure(simConfig);
+    }
+
+    //resize every buffer for simConfig and restart the scene from its initial conditions
+    void configure(const SimulationConfig &simConfig){
+        if(simConfig.numThreads != config.numThreads)
+            threadPool.setNumThreads(simConfig.numThreads);
+        config = simConfig;
+        gridDimensions = config.gridDimensions;
+        spacing = config.spacing;
+        mouseObstacle.radius = config.mouseObstacleRadius;
+        stepCount = 0;
+        frameTime = 0.0f;
+        restDensity = 0.0f;
+        lastPressureSolve = {};
+        lastSubsteps = 0;
+        particles.resize(config.numParticles);
+        gridIndexing.init(gridDimensions);
+        fluidGrid.reset(gridIndexing.size());
+        pressure.assign(gridIndexing.size(),0.0f);
+        pressureRhs.resize(gridIndexing.size());
+        gatherValid[0].resize(gridIndexing.size());
+        gatherValid[1].resize(gridIndexing.size());
+        waterCells.clear();
+        previousWaterCells.clear();
+        spatialHash.resize(gridIndexing.size(),particles.size());
         //set particles initial conditions
         for(int i{};i<particles.size();i++){
-            particles.at(i).position = glm::vec2((i%(gridDimensions.x/2))+spacing+particleRadius,(2*i/gridDimensions.x)+spacing+particleRadius);
-            particles.at(i).velocity = glm::vec2(10.0f,10.0f);
+            particles.setPosition(i,glm::vec2((i%(gridDimensions.x/2))+spacing+particleRadius,(2*i/gridDimensions.x)+spacing+particleRadius));
+            particles.setVelocity(i,glm::vec2(10.0f,10.0f));
+            particles.color[i] = WATER_COLOR;
         }
-        //set wall cells to be solid else they are set to air.
-        for(int i{};i<gridDimensions.x;i++){
-            for (int j{};j<gridDimensions.y;j++){
+        particles.savePositions();
+        //set wall and ghost cells to be solid else they are set to air.
+        for(int i{-GRID_GHOST_CELLS};i<gridDimensions.x+GRID_GHOST_CELLS;i++){
+            for (int j{-GRID_GHOST_CELLS};j<gridDimensions.y+GRID_GHOST_CELLS;j++){
                 int index = gridCoordIndex({i,j});
-                if(i==0 || j==0 || i == gridDimensions.x-1 || j==gridDimensions.y-1){
-                    fluidGrid.at(index).type = SOLID;
+                if(i<=0 || j<=0 || i >= gridDimensions.x-1 || j>=gridDimensions.y-1){
+                    fluidGrid.type[index] = SOLID;
                 } else {
-                    fluidGrid.at(index).type = AIR;
-
+                    fluidGrid.type[index] = AIR;
                 }
             }
         }
+        solidsChanged();
+    }
+
+    int numThreads() const { return threadPool.size(); }
+
+    //advance the simulation clock by frameDt seconds of wall time in steps of config.fixedTimestep so every step costs
+    //the same and stays stable whatever the frame rate. Time left over is carried to the next frame, returns the steps taken.
+    //At most config.maxStepsPerFrame steps run, anything beyond that is dropped so a slow frame cannot snowball.
+    int advance(float frameDt){
+        frameTime += frameDt;
+        int steps {std::min(static_cast<int>(frameTime/config.fixedTimestep),config.maxStepsPerFrame)};
+        if(steps == 0) return 0;
+        //the mouse moved over the whole frame, spread its velocity across every step taken for it
+        updateObstacleVelocity(config.timeScale*steps*config.fixedTimestep);
+        for(int s{};s<steps;s++)
+            step(config.fixedTimestep);
+        frameTime -= steps*config.fixedTimestep;
+        if(frameTime >= config.fixedTimestep)
+            frameTime = std::fmod(frameTime,config.fixedTimestep);
+        return steps;
+    }
 
+    //how far the clock is between the last two steps, 0 to 1. Drawing prevX/prevY blended alpha of the way towards x/y
+    //instead of the latest positions keeps motion smooth when steps and frames do not line up. The renderer does the
+    //blend in vertex.vert, with alpha from simulationSnapshot::interpolationAlpha.
+    float interpolationAlpha() const {
+        return frameTime/config.fixedTimestep;
     }
+
+    //one step of dt seconds (before timeScale), split into as many substeps as config.cflNumber needs
     void simulate(float dt){
-        //integrate(2*dt); 
-        integrate(TIME_SCALE*dt);
-        pushApart();
-        handleObstacles(TIME_SCALE*dt);
-        transferVelocities(true,FLIP_PIC_RATIO);
-        computeDensities();
-        makeIncompressible();
-        transferVelocities(false,FLIP_PIC_RATIO);
-        colorParticles();
+        updateObstacleVelocity(config.timeScale*dt);
+        step(dt);
     }
 
 private:
     float particleRadius = 0.5f;
-    float spacing = SPACING; //size of one grid cell
-    std::vector<int> grid; //collision grid column by column for spatial hash.
-    std::vector<int> particleIDs; //indices of particles arranged by cell.
-    std::vector<fluidCell> fluidGrid; // each cell is air, water or solid and has velocities moving into it.
-    int numIters = NUM_ITERS;
-    float restDensity;
+    float spacing {}; //size of one grid cell, config.spacing as of the last configure()
+    GridIndexing gridIndexing; //cell coordinate to index layout shared by spatialHash and fluidGrid, see GridIndexing.h
+    SpatialHash spatialHash; //particles sorted into the grid cells, rebuilt at the start of pushApart
+    ParticleArrays reorderScratch; //previous particle order, kept so reordering does not allocate
+    long stepCount {}; //steps taken, substeps of one step count once
+    float frameTime {}; //wall time advance() has not simulated yet, always below config.fixedTimestep between calls
+    FluidGrid fluidGrid; // each cell is air, water or solid and has velocities on its left and bottom faces, see FluidGrid.h
+    std::vector<float> pressure; //per cell pressure whose gradient the last solve applied, zero outside water, kept as the next initial guess
+    std::vector<float> pressureRhs; //divergence the pressure has to remove from each water cell
+    alignedVector<float> gatherValid[2]; //u and v samples the grid to particle gather may use, see GridToParticles.h
+    std::vector<float> blockMaxSpeed2; //largest squared particle speed of each GATHER_BLOCK_SIZE block, see substepsNeeded
+    std::vector<glm::ivec2> waterCells; //interior water cells in column order (i then j), appended while the transfer to the grid marks them
+    std::vector<glm::ivec2> previousWaterCells; //the list before the current transfer, those cells are reset to air
+    std::vector<std::vector<glm::ivec2>> stripWaterCells; //water cells marked by each strip of transferToGridStrips
+    relaxColourCells colourWaterCells[2]; //the same cells split by checkerboard colour (i+j)%2 for red black sweeps, see PressureRelax.h
+    alignedVector<float> relaxDelta; //corrections of one colour's cells during a red black half sweep
+    PCGSolver pcgSolver;
+    MultigridSolver multigridSolver;
+    float restDensity {}; //set from the first step's water cells
     
     //get the coordinate of the grid cell in which the particle is currently located
-    glm::ivec2 getGridCoords(glm::vec2 pos){
+    glm::ivec2 getGridCoords(glm::vec2 pos) const{
         glm::ivec2 coords {(int)std::floor(pos.x/spacing),(int)std::floor(pos.y/spacing)};
         coords = glm::clamp(coords,{0,0},{gridDimensions.x-1,gridDimensions.y-1});
         return coords;
     }
 
     //get the 1D index for a given 2D grid cell coordinate
-    int gridCoordIndex(glm::ivec2 coord){
-        int index {static_cast<int>(gridDimensions.y * coord.x + coord.y)};
-        return index;
+    int gridCoordIndex(glm::ivec2 coord) const{
+        return gridIndexing.index(coord);
+    }
+
+    //velocity the mouse obstacle moved with over the last dt seconds of simulated time, taken once per simulate() or advance()
+    void updateObstacleVelocity(float dt){
+        mouseObstacle.velocity = (mouseObstacle.position- mouseObstacle.prevPos)/dt;
+        mouseObstacle.prevPos = mouseObstacle.position;
+    }
+
+    void step(float dt){
+        PHASE_TIMER(phaseTimings,PHASE_STEP);
+        stepCount++;
+        particles.savePositions();
+        float stepDt {config.timeScale*dt};
+        int substeps {substepsNeeded(stepDt)};
+        lastSubsteps = substeps;
+        //reorder at most once per step so the cadence does not depend on how many substeps the fluid needs
+        bool reorder {config.reorderInterval>0 && stepCount%config.reorderInterval==0};
+        for(int s{};s<substeps;s++){
+            substep(stepDt/substeps,1.0f/substeps,reorder && s==0);
+        }
+    }
+
+    //stepFraction is the share of the whole step this substep covers, it scales the mouse impulse.
+    //reorder sorts the particles into cell order while pushApart has them hashed.
+    void substep(float dt, float stepFraction, bool reorder){
+        integrate(dt);
+        pushApart(reorder);
+        handleObstacles(stepFraction);
+        transferToGrid();
+        makeIncompressible();
+        transferToParticles(config.flipPicRatio);
+        colorParticles();
+    }
+
+    //fewest substeps that keep every particle within config.cflNumber cells of travel per substep, at most config.maxSubsteps.
+    //The speed bound adds what gravity and the mouse impulse can add during the step to the fastest particle.
+    int substepsNeeded(float dt){
+        if(config.cflNumber <= 0.0f) return 1;
+        int n {particles.size()};
+        const float *vx {particles.vx.data()}, *vy {particles.vy.data()};
+        int blocks {(n+GATHER_BLOCK_SIZE-1)/GATHER_BLOCK_SIZE};
+        blockMaxSpeed2.resize(blocks);
+        threadPool.parallelFor(0,blocks,[&](int block){
+            float maxSpeed2 {};
+            for(int i{block*GATHER_BLOCK_SIZE};i<std::min(n,(block+1)*GATHER_BLOCK_SIZE);i++)
+                maxSpeed2 = std::max(maxSpeed2,vx[i]*vx[i] + vy[i]*vy[i]);
+            blockMaxSpeed2[block] = maxSpeed2;
+        });
+        float maxSpeed2 {};
+        for(float blockMax:blockMaxSpeed2) maxSpeed2 = std::max(maxSpeed2,blockMax);
+        float speed {std::sqrt(maxSpeed2) + std::abs(config.gravity)*dt + 0.6f*glm::length(mouseObstacle.velocity)};
+        float cells {speed*dt/(config.cflNumber*spacing)};
+        return glm::clamp(static_cast<int>(std::ceil(cells)),1,config.maxSubsteps);
     }
 
     //semi implicit euler integration to calculate particle positions under gravity.
     void integrate(float dt){
-        for(auto &particle:particles){
-            particle.velocity += glm::vec2(0.0f, dt*gravity);
-            particle.position += dt*particle.velocity;
+        PHASE_TIMER(phaseTimings,PHASE_INTEGRATE);
+        int n {particles.size()};
+        float *x {particles.x.data()}, *y {particles.y.data()};
+        const float *vx {particles.vx.data()};
+        float *vy {particles.vy.data()};
+        for(int i{};i<n;i++){
+            vy[i] += dt*config.gravity;
+            x[i] += dt*vx[i];
+            y[i] += dt*vy[i];
         }
     }
 
     //push particles out of each other
-    void pushApart(){
+    void pushApart(bool reorder){
+        PHASE_TIMER(phaseTimings,PHASE_PUSH_APART);
         //FILL SPATIAL HASH GRID
-        //clear grid
-        grid = std::vector<int>(gridDimensions.x*gridDimensions.y + 1,0);
-        //count number of particles in each cell
-        for(int i{};i<NUM_PARTICLES;i++){
-            int gridIndex = gridCoordIndex(getGridCoords(particles.at(i).position));
-            grid.at(gridIndex)++;
-        }
-        //insert running total particle counts
-        int current {};
-        for(int i{};i<grid.size()-1;i++){
-            current += grid.at(i);
-            grid.at(i) = current;
+        int n {particles.size()};
+        const float *x {particles.x.data()}, *y {particles.y.data()};
+        spatialHash.build(n,[&](int i){ return gridCoordIndex(getGridCoords({x[i],y[i]})); });
+        //physically move particles into cell order every so often, as the fluid mixes spawn order gets more random
+        if(reorder){
+            particles.permute(spatialHash.particleIDs.data(),reorderScratch);
+            spatialHash.particlesReordered();
+            x = particles.x.data();
+            y = particles.y.data();
         }
 
-        grid.at(grid.size()-1) = NUM_PARTICLES; //guard
-        
-        //fill particleIDs
-        for(int i{};i<NUM_PARTICLES;i++){
-            int gridIndex = gridCoordIndex(getGridCoords(particles.at(i).position));
-            particleIDs.at(--grid.at(gridIndex)) = i; 
+        //PUSH PARTICLES APART
+        if(config.parallelPushApart){
+            pushApartTiled();
+            return;
         }
+        for (int iter{};iter<config.pushApartIters;iter++){
+            for(int i{};i<n;i++){
+                separateParticle(i,getGridCoords({x[i],y[i]}));
+            }
+        }
+    }
 
-        //PUSH PARTICLES APART
-        for (int iter{};iter<numIters;iter++){
-            for(int i{};i<NUM_PARTICLES;i++){
-                Particle &p {particles.at(i)};
-                glm::ivec2 gridCoords = getGridCoords(p.position);
-                int xStart {std::max(gridCoords.x-1,1)}, xEnd {std::min(gridCoords.x+1,gridDimensions.x-1)};
-                int yStart {std::max(gridCoords.y-1,1)}, yEnd {std::min(gridCoords.y+1,gridDimensions.y-1)};
-                for(int xi{xStart};xi<=xEnd;xi++){
-                    for(int yi{yStart};yi<=yEnd;yi++){
-                        int index = gridCoordIndex({xi,yi});
-                        for(int pi{grid[index]};pi<grid[index+1];pi++){
-                            glm::vec2 &p2 {particles.at(particleIDs[pi]).position};
-                            if(pi==i || glm::dot(p2-p.position,p2-p.position)>=4.0f*particleRadius*particleRadius) continue;
-                            float distance = glm::length(p2-p.position);
-                            
-                            if(distance != 0.0f){
-                                glm::vec2 normed = (p2-p.position)*(1.0f/distance);
-                                glm::vec2 movep {(normed*(particleRadius-(distance/2.0f)))};
-                                p.position -= movep;
-                                p2 += movep;
+    //Gauss-Seidel separation in parallel. The grid is cut into square tiles coloured in a 2x2 pattern, a particle
+    //only touches particles in its own and the adjacent cells, so tiles of one colour never share a particle and
+    //can run concurrently. Particles are looked up by the cell they were hashed into, not their moving position,
+    //which keeps every write inside the tile plus a one cell border.
+    void pushApartTiled(){
+        int tilesX {(gridDimensions.x+PUSH_APART_TILE_SIZE-1)/PUSH_APART_TILE_SIZE};
+        int tilesY {(gridDimensions.y+PUSH_APART_TILE_SIZE-1)/PUSH_APART_TILE_SIZE};
+        int colourTilesX {(tilesX+1)/2}, colourTilesY {(tilesY+1)/2}; //upper bound on tiles of one colour per axis
+        for (int iter{};iter<config.pushApartIters;iter++){
+            for(int colour{};colour<4;colour++){
+                int offsetX {colour%2}, offsetY {colour/2};
+                threadPool.parallelFor(0,colourTilesX*colourTilesY,[&](int t){
+                    int tx {2*(t/colourTilesY)+offsetX}, ty {2*(t%colourTilesY)+offsetY};
+                    if(tx>=tilesX || ty>=tilesY) return;
+                    int xEnd {std::min((tx+1)*PUSH_APART_TILE_SIZE,gridDimensions.x)};
+                    int yEnd {std::min((ty+1)*PUSH_APART_TILE_SIZE,gridDimensions.y)};
+                    for(int xi{tx*PUSH_APART_TILE_SIZE};xi<xEnd;xi++){
+                        for(int yi{ty*PUSH_APART_TILE_SIZE};yi<yEnd;yi++){
+                            int index = gridCoordIndex({xi,yi});
+                            for(int pi{spatialHash.cellBegin(index)};pi<spatialHash.cellEnd(index);pi++){
+                                separateParticle(spatialHash.particleIDs[pi],{xi,yi});
                             }
                         }
                     }
+                });
+            }
+        }
+    }
+
+    //push particle i out of every overlapping particle in the 3x3 cells around gridCoords
+    void separateParticle(int i, glm::ivec2 gridCoords){
+        float *x {particles.x.data()}, *y {particles.y.data()};
+        const int *cellStart {spatialHash.cellStart.data()}, *particleIDs {spatialHash.particleIDs.data()};
+        glm::vec2 p {x[i],y[i]};
+        int xStart {std::max(gridCoords.x-1,1)}, xEnd {std::min(gridCoords.x+1,gridDimensions.x-1)};
+        int yStart {std::max(gridCoords.y-1,1)}, yEnd {std::min(gridCoords.y+1,gridDimensions.y-1)};
+        for(int xi{xStart};xi<=xEnd;xi++){
+            for(int yi{yStart};yi<=yEnd;yi++){
+                int index = gridCoordIndex({xi,yi});
+                for(int pi{cellStart[index]};pi<cellStart[index+1];pi++){
+                    int id {particleIDs[pi]};
+                    glm::vec2 p2 {x[id],y[id]};
+                    if(id==i || glm::dot(p2-p,p2-p)>=4.0f*particleRadius*particleRadius) continue;
+                    float distance = glm::length(p2-p);
+                    
+                    if(distance != 0.0f){
+                        glm::vec2 normed = (p2-p)*(1.0f/distance);
+                        glm::vec2 movep {(normed*(particleRadius-(distance/2.0f)))};
+                        p -= movep;
+                        x[id] += movep.x;
+                        y[id] += movep.y;
+                    }
                 }
             }
         }
+        x[i] = p.x;
+        y[i] = p.y;
     }
                 
     //push particles out of walls
-    void handleObstacles(float dt){
-        //update mouse obstacle velocity
-        mouseObstacle.velocity = (mouseObstacle.position- mouseObstacle.prevPos)/(TIME_SCALE*dt);
-        mouseObstacle.prevPos = mouseObstacle.position;
+    void handleObstacles(float stepFraction){
+        PHASE_TIMER(phaseTimings,PHASE_HANDLE_OBSTACLES);
 
         float leftWall {spacing}, rightWall {spacing*gridDimensions.x-spacing}, lowerWall {spacing}, upperWall{spacing * gridDimensions.y-spacing};
-        for(int i{};i<NUM_PARTICLES;i++){
-            Particle &p = particles.at(i);
+        int n {particles.size()};
+        float *x {particles.x.data()}, *y {particles.y.data()};
+        float *vx {particles.vx.data()}, *vy {particles.vy.data()};
+        float edgeDist2 {(mouseObstacle.radius+particleRadius)*(mouseObstacle.radius+particleRadius)};
+        glm::vec2 mouseImpulse {0.6f * stepFraction * mouseObstacle.velocity};
+        for(int i{};i<n;i++){
             //mouse obstacle
-            float edgeDist2 {(mouseObstacle.radius+particleRadius)*(mouseObstacle.radius+particleRadius)};
-            float dist2 {glm::dot(p.position-mouseObstacle.position,p.position-mouseObstacle.position)};
-            if(dist2 < edgeDist2){
-                p.velocity += 0.6f * mouseObstacle.velocity;
-                //p.color = {1.0f,0.0f,0.0f}; //debug change color on mouseObstacle collision
+            float ox {x[i]-mouseObstacle.position.x}, oy {y[i]-mouseObstacle.position.y};
+            if(ox*ox + oy*oy < edgeDist2){
+                vx[i] += mouseImpulse.x;
+                vy[i] += mouseImpulse.y;
             }
 
             //walls
-            if(p.position.x < leftWall+particleRadius){
-                p.position.x = leftWall + particleRadius;
-                p.velocity.x = 0.0f;
+            if(x[i] < leftWall+particleRadius){
+                x[i] = leftWall + particleRadius;
+                vx[i] = 0.0f;
             }
-            if(p.position.x > rightWall-particleRadius){
-                p.position.x = rightWall-particleRadius;
-                p.velocity.x = 0.0f;
+            if(x[i] > rightWall-particleRadius){
+                x[i] = rightWall-particleRadius;
+                vx[i] = 0.0f;
             }
-            if(p.position.y < lowerWall+particleRadius){
-                p.position.y = lowerWall+particleRadius;
-                p.velocity.y = 0.0f;
+            if(y[i] < lowerWall+particleRadius){
+                y[i] = lowerWall+particleRadius;
+                vy[i] = 0.0f;
             }
-            if(p.position.y > upperWall-particleRadius){
-                p.position.y = upperWall-particleRadius;
-                p.velocity.y = 0.0f;
+            if(y[i] > upperWall-particleRadius){
+                y[i] = upperWall-particleRadius;
+                vy[i] = 0.0f;
             }
         }
     }
 
-    //transfer particle velocities to and from the fluidGrid
-    void transferVelocities(bool toGrid, float flipPicRatio){
-        if(toGrid){
-            //clear cell velocities and weights
-            for(int i{};i<fluidGrid.size();i++){
-                fluidGrid.at(i).velocity = {0.0f,0.0f};
-                fluidGrid.at(i).weights = {0.0f,0.0f};
-                fluidGrid.at(i).type = (fluidGrid.at(i).type!= SOLID?AIR:SOLID);
+    //the four grid samples around a point and their bilinear weights, sample k is (x0,y0), (x1,y0), (x1,y1), (x0,y1)
+    //for k = 0..3
+    struct gridStencil{
+        int x0, x1, y0, y1;
+        int i0, i1, i2, i3; //fluidGrid indices for cells
+        float w0, w1, w2, w3; //weights
+    };
+
+    //gridPos is the position in cell units minus the offset of the samples from the cell corners
+    gridStencil getStencil(glm::vec2 gridPos) const{
+        //keep pos in bounds, it is then at least 1 so truncating gives the cell
+        gridPos.x = glm::clamp(gridPos.x,1.0f,gridDimensions.x-1.0f);
+        gridPos.y = glm::clamp(gridPos.y,1.0f,gridDimensions.y-1.0f);
+        gridStencil st;
+        st.x0 = static_cast<int>(gridPos.x);
+        st.y0 = static_cast<int>(gridPos.y);
+        st.x1 = st.x0+1; //at most gridDimensions, the ghost border
+        st.y1 = st.y0+1;
+        st.i0 = gridCoordIndex({st.x0,st.y0});
+        st.i1 = gridCoordIndex({st.x1,st.y0});
+        st.i2 = gridCoordIndex({st.x1,st.y1});
+        st.i3 = gridCoordIndex({st.x0,st.y1});
+        float sx {gridPos.x-st.x0}, sy {gridPos.y-st.y0};
+        float tx {1-sx}, ty {1-sy};
+        st.w0 = tx*ty;
+        st.w1 = sx*ty;
+        st.w2 = sx*sy;
+        st.w3 = tx*sy;
+        return st;
+    }
+
+    //particle to grid in one pass over the particles: marks water cells and accumulates the weighted horizontal
+    //velocities (sampled on left faces), vertical velocities (bottom faces) and the cell centred densities.
+    void transferToGrid(){
+        PHASE_TIMER(phaseTimings,PHASE_TRANSFER_TO_GRID);
+        int n {particles.size()};
+        const float *x {particles.x.data()}, *y {particles.y.data()};
+        float *u {fluidGrid.u.data()}, *v {fluidGrid.v.data()};
+        float *uWeight {fluidGrid.uWeight.data()}, *vWeight {fluidGrid.vWeight.data()};
+        cellType *type {fluidGrid.type.data()};
+        int numCells {fluidGrid.size()};
+        //clear cell velocities, weights and densities
+        std::fill(fluidGrid.u.begin(),fluidGrid.u.end(),0.0f);
+        std::fill(fluidGrid.v.begin(),fluidGrid.v.end(),0.0f);
+        std::fill(fluidGrid.uWeight.begin(),fluidGrid.uWeight.end(),0.0f);
+        std::fill(fluidGrid.vWeight.begin(),fluidGrid.vWeight.end(),0.0f);
+        std::fill(fluidGrid.density.begin(),fluidGrid.density.end(),0.0f);
+        //only last step's water cells can be anything but air or solid, so resetting those resets every type
+        std::swap(waterCells,previousWaterCells);
+        for(glm::ivec2 cell:previousWaterCells){
+            type[gridCoordIndex(cell)] = AIR;
+        }
+        waterCells.clear();
+        if(config.parallelTransfer){
+            transferToGridStrips();
+        } else {
+            for(int i{};i<n;i++){
+                //set cells to water if they contain any particles.
+                glm::ivec2 coords {getGridCoords({x[i],y[i]})};
+                int c {gridCoordIndex(coords)};
+                if(type[c] == AIR){
+                    type[c] = WATER;
+                    waterCells.push_back(coords);
+                }
+                scatterParticle(i);
             }
-            //set cells to water if they contain any particles.
-            for(int i{};i<NUM_PARTICLES;i++){
-                int index = gridCoordIndex(getGridCoords(particles.at(i).position));           
-                fluidGrid.at(index).type = WATER;
+            //particles mark cells in any order, the sweeps and solvers expect column order
+            std::sort(waterCells.begin(),waterCells.end(),[](glm::ivec2 a, glm::ivec2 b){
+                return a.x < b.x || (a.x == b.x && a.y < b.y);
+            });
+        }
+        for(int i{};i<numCells;i++){
+            if(uWeight[i] > 0.0f)
+                u[i] /= uWeight[i];
+            if(vWeight[i] > 0.0f)
+                v[i] /= vWeight[i];
+        }
+
+        //On first execution we set the initial density
+        if (restDensity==0.0f){
+            float densitySum{};
+            for(glm::ivec2 cell:waterCells){
+                densitySum += fluidGrid.density[gridCoordIndex(cell)];
             }
+            if(!waterCells.empty()) restDensity = densitySum/waterCells.size();
+        }
+        //air holds zero pressure, so cells that stopped being water lose the pressure kept for warm starting
+        for(glm::ivec2 cell:previousWaterCells){
+            int c {gridCoordIndex(cell)};
+            if(type[c] != WATER) pressure[c] = 0.0f;
         }
+        colourWaterCells[0].clear();
+        colourWaterCells[1].clear();
+        for(glm::ivec2 cell:waterCells){
+            colourWaterCells[(cell.x+cell.y)%2].push(gridCoordIndex(cell),gridCoordIndex({cell.x+1,cell.y}),
+                                                     gridCoordIndex({cell.x,cell.y+1}));
+        }
+        relaxDelta.resize(std::max(colourWaterCells[0].size(),colourWaterCells[1].size()));
+    }
 
-        for(int component{};component<2;component++){ //horizontal component then vertical component
-            for(int i{};i<NUM_PARTICLES;i++){ //calculate weights and transfer velocities
-                //calculate weights for horizontal grid velocities
-                glm::vec2 pos {particles.at(i).position.x,particles.at(i).position.y}; 
-                pos -= glm::vec2({component*spacing/2.0f,(1-component)*spacing/2.0f}); //shift particle for staggered grid
-                pos.x = glm::clamp(pos.x,spacing,spacing*(gridDimensions.x-1)); //keep pos in bounds
-                pos.y = glm::clamp(pos.y,spacing,spacing*(gridDimensions.y-1));
-                glm::ivec2 q0{getGridCoords(pos)};//coords of 4 surrounding cells
-                glm::ivec2 q1{std::min(q0.x+1,gridDimensions.x-2),q0.y};
-                glm::ivec2 q2{q1.x,std::min(q1.y+1,gridDimensions.y-2)};
-                glm::ivec2 q3{q0.x,std::min(q0.y+1,gridDimensions.y-2)};
-                int i0{gridCoordIndex(q0)},i1{gridCoordIndex(q1)},i2{gridCoordIndex(q2)},i3{gridCoordIndex(q3)}; //fluidGrid indices for cells
-                float dx{pos.x-q0.x*spacing}, dy{pos.y-q0.y*spacing}; //here the repeated parts of the bilinear interp values are calculated
-                float sx {dx/spacing}, sy{dy/spacing};
-                float tx {1-sx}, ty {1-sy};
-                float w0{tx*ty}, w1{sx*ty}, w2{sx*sy} ,w3{tx*sy}; //weights
-
-
-                if(toGrid){ //sum weighted velocities and weights for each cell.
-                    fluidGrid.at(i0).velocity[component] += w0*particles.at(i).velocity[component];
-                    fluidGrid.at(i1).velocity[component] += w1*particles.at(i).velocity[component];
-                    fluidGrid.at(i2).velocity[component] += w2*particles.at(i).velocity[component];
-                    fluidGrid.at(i3).velocity[component] += w3*particles.at(i).velocity[component];
-                    fluidGrid.at(i0).weights[component] += w0;
-                    fluidGrid.at(i1).weights[component] += w1;
-                    fluidGrid.at(i2).weights[component] += w2;
-                    fluidGrid.at(i3).weights[component] += w3;
-                } else { //handle transfer from grid to particles
-                    //ensure we do not consider velocities between two air cells
-                    int adjacentOffset = (component)?1:gridDimensions.y;
-                    bool isValid0 {fluidGrid.at(i0).type != AIR || fluidGrid.at(i0-adjacentOffset).type != AIR};
-                    bool isValid1 {fluidGrid.at(i1).type != AIR || fluidGrid.at(i1-adjacentOffset).type != AIR};
-                    bool isValid2 {fluidGrid.at(i2).type != AIR || fluidGrid.at(i2-adjacentOffset).type != AIR};
-                    bool isValid3 {fluidGrid.at(i3).type != AIR || fluidGrid.at(i3-adjacentOffset).type != AIR};
-                    
-                    float w = isValid0*w0 + isValid1*w1 + isValid2*w2 + isValid3*w3;
-                    if(w > 0.0f){ //average out grid velocities
-                        float pic = (isValid0*w0*fluidGrid.at(i0).velocity[component] +
-                                    isValid1*w1*fluidGrid.at(i1).velocity[component] +
-                                    isValid2*w2*fluidGrid.at(i2).velocity[component] +
-                                    isValid3*w3*fluidGrid.at(i3).velocity[component])/w;
-                        float flipDelta = (isValid0*w0*(fluidGrid.at(i0).velocity[component]-fluidGrid.at(i0).prevVelocity[component]) +
-                                    isValid1*w1*(fluidGrid.at(i1).velocity[component]-fluidGrid.at(i1).prevVelocity[component]) +
-                                    isValid2*w2*(fluidGrid.at(i2).velocity[component]-fluidGrid.at(i2).prevVelocity[component]) +
-                                    isValid3*w3*(fluidGrid.at(i3).velocity[component]-fluidGrid.at(i3).prevVelocity[component]))/w;
-                        float flip = flipDelta + particles.at(i).velocity[component];
-                        particles.at(i).velocity[component] = flipPicRatio*flip + (1.0f-flipPicRatio)*pic; //transfer to particles
+    //Parallel scatter without atomics. Particles are sorted into cells, a particle in column c only writes columns
+    //c-1 to c+2, so the grid is cut into strips of TRANSFER_STRIP_WIDTH columns and alternate strips run at once.
+    //Each strip walks its cells in order, so every grid sum is added up in the same order whatever the thread count.
+    //The cells each strip marks as water are joined into waterCells afterwards.
+    void transferToGridStrips(){
+        const float *x {particles.x.data()}, *y {particles.y.data()};
+        spatialHash.build(particles.size(),[&](int i){ return gridCoordIndex(getGridCoords({x[i],y[i]})); });
+        int numStrips {(gridDimensions.x+TRANSFER_STRIP_WIDTH-1)/TRANSFER_STRIP_WIDTH};
+        stripWaterCells.resize(numStrips);
+        for(int colour{};colour<2;colour++){
+            threadPool.parallelFor(0,(numStrips+1-colour)/2,[&](int s){
+                int strip {2*s+colour};
+                int xEnd {std::min((strip+1)*TRANSFER_STRIP_WIDTH,gridDimensions.x)};
+                std::vector<glm::ivec2> &cells {stripWaterCells[strip]};
+                cells.clear();
+                for(int xi{strip*TRANSFER_STRIP_WIDTH};xi<xEnd;xi++){
+                    for(int yi{};yi<gridDimensions.y;yi++){
+                        int index = gridCoordIndex({xi,yi});
+                        if(spatialHash.cellBegin(index) == spatialHash.cellEnd(index)) continue;
+                        if(fluidGrid.type[index] == AIR){
+                            fluidGrid.type[index] = WATER;
+                            cells.push_back({xi,yi});
+                        }
+                        for(int pi{spatialHash.cellBegin(index)};pi<spatialHash.cellEnd(index);pi++){
+                            scatterParticle(spatialHash.particleIDs[pi]);
+                        }
                     }
-
                 }
-
-            }
+            });
         }
-        if(toGrid){
-            for(int i{};i<fluidGrid.size();i++){
-                if(fluidGrid.at(i).weights.x > 0.0f)
-                    fluidGrid.at(i).velocity.x /= fluidGrid.at(i).weights.x;
-                if(fluidGrid.at(i).weights.y > 0.0f)
-                    fluidGrid.at(i).velocity.y /= fluidGrid.at(i).weights.y; 
-            }
+        //strips cover the columns in order, so joining their lists keeps the water cells in column order
+        for(const std::vector<glm::ivec2> &cells:stripWaterCells){
+            waterCells.insert(waterCells.end(),cells.begin(),cells.end());
         }
     }
 
+    //add particle i's velocity and density contributions to the four surrounding samples of each staggered grid
+    void scatterParticle(int i){
+        float *u {fluidGrid.u.data()}, *v {fluidGrid.v.data()};
+        float *uWeight {fluidGrid.uWeight.data()}, *vWeight {fluidGrid.vWeight.data()};
+        float *density {fluidGrid.density.data()};
+        float vx {particles.vx[i]}, vy {particles.vy[i]};
+        //the staggered grids sample u on left faces, v on bottom faces and density at cell centres
+        glm::vec2 gridPos {glm::vec2(particles.x[i],particles.y[i])*(1.0f/spacing)};
+        //sum weighted velocities and weights for each cell.
+        gridStencil su {getStencil(gridPos-glm::vec2(0.0f,0.5f))};
+        u[su.i0] += su.w0*vx;
+        u[su.i1] += su.w1*vx;
+        u[su.i2] += su.w2*vx;
+        u[su.i3] += su.w3*vx;
+        uWeight[su.i0] += su.w0;
+        uWeight[su.i1] += su.w1;
+        uWeight[su.i2] += su.w2;
+        uWeight[su.i3] += su.w3;
+        gridStencil sv {getStencil(gridPos-glm::vec2(0.5f,0.0f))};
+        v[sv.i0] += sv.w0*vy;
+        v[sv.i1] += sv.w1*vy;
+        v[sv.i2] += sv.w2*vy;
+        v[sv.i3] += sv.w3*vy;
+        vWeight[sv.i0] += sv.w0;
+        vWeight[sv.i1] += sv.w1;
+        vWeight[sv.i2] += sv.w2;
+        vWeight[sv.i3] += sv.w3;
+        gridStencil sd {getStencil(gridPos-glm::vec2(0.5f,0.5f))};
+        density[sd.i0] += sd.w0;
+        density[sd.i1] += sd.w1;
+        density[sd.i2] += sd.w2;
+        density[sd.i3] += sd.w3;
+    }
+
+    //grid to particles, blends the FLIP velocity change with the PIC interpolated velocity. The face validity is
+    //flattened into float masks first, then blocks of particles gather from the grid in parallel.
+    void transferToParticles(float flipPicRatio){
+        PHASE_TIMER(phaseTimings,PHASE_TRANSFER_TO_PARTICLES);
+        const cellType *type {fluidGrid.type.data()};
+        threadPool.parallelFor(0,gridDimensions.x+1,[&](int i){
+            for(int j{};j<=gridDimensions.y;j++){
+                int c {gridCoordIndex({i,j})};
+                //ensure we do not consider velocities between two air cells
+                gatherValid[0][c] = (type[c] != AIR || type[gridCoordIndex({i-1,j})] != AIR) ? 1.0f : 0.0f;
+                gatherValid[1][c] = (type[c] != AIR || type[gridCoordIndex({i,j-1})] != AIR) ? 1.0f : 0.0f;
+            }
+        });
+        gatherGrid grid {gridDimensions,1.0f/spacing,&gridIndexing,
+                         {gatherValid[0].data(),gatherValid[1].data()},
+                         {fluidGrid.u.data(),fluidGrid.v.data()},
+                         {fluidGrid.uPrev.data(),fluidGrid.vPrev.data()}};
+        int n {particles.size()};
+        const float *x {particles.x.data()}, *y {particles.y.data()};
+        float *vx {particles.vx.data()}, *vy {particles.vy.data()};
+        threadPool.parallelFor(0,(n+GATHER_BLOCK_SIZE-1)/GATHER_BLOCK_SIZE,[&](int block){
+            gatherVelocities(grid,x,y,vx,vy,block*GATHER_BLOCK_SIZE,std::min(n,(block+1)*GATHER_BLOCK_SIZE),flipPicRatio);
+        });
+    }
+
     void makeIncompressible(){
-        for(int i{};i<fluidGrid.size();i++){
-            fluidGrid.at(i).prevVelocity = fluidGrid.at(i).velocity; //make a copy of velocities for later
+        PHASE_TIMER(phaseTimings,PHASE_MAKE_INCOMPRESSIBLE);
+        //make a copy of velocities for later
+        std::copy(fluidGrid.u.begin(),fluidGrid.u.end(),fluidGrid.uPrev.begin());
+        std::copy(fluidGrid.v.begin(),fluidGrid.v.end(),fluidGrid.vPrev.begin());
+        if(!config.warmStartPressure){
+            for(glm::ivec2 cell:waterCells) pressure[gridCoordIndex(cell)] = 0.0f;
+        }
+        if(config.solver == PCG || config.solver == MULTIGRID){
+            solvePressure();
+            return;
         }
-        for (int iter{};iter<numIters;iter++){
-            for(int i{1};i<gridDimensions.x-1;i++){
-                for(int j{1};j<gridDimensions.y-1;j++){
-                    if(fluidGrid.at(gridCoordIndex({i,j})).type != WATER) continue;
-                    float div {fluidGrid.at(gridCoordIndex({i+1,j})).velocity.x -
-                               fluidGrid.at(gridCoordIndex({i,j})).velocity.x +
-                               fluidGrid.at(gridCoordIndex({i,j+1})).velocity.y -
-                               fluidGrid.at(gridCoordIndex({i,j})).velocity.y};
-                    int sLeft {fluidGrid.at(gridCoordIndex({i-1,j})).type!=SOLID?1:0};
-                    int sRight {fluidGrid.at(gridCoordIndex({i+1,j})).type!=SOLID?1:0};
-                    int sBottom {fluidGrid.at(gridCoordIndex({i,j-1})).type!=SOLID?1:0};
-                    int sTop {fluidGrid.at(gridCoordIndex({i,j+1})).type!=SOLID?1:0};
-                    div *= OVERRELAX;
-                    //adjust for drift
-                    float compression = fluidGrid.at(gridCoordIndex({i,j})).density - restDensity;
-                    if (compression>0.0f) 
-                        div -= COMPRESSION_FACTOR*compression; 
-                    float s = sLeft + sRight + sBottom + sTop;
-                    if (s==0) continue;
-                    div /= s;
-                    fluidGrid.at(gridCoordIndex({i,j})).velocity.x += div*sLeft;
-                    fluidGrid.at(gridCoordIndex({i+1,j})).velocity.x -= div*sRight;
-                    fluidGrid.at(gridCoordIndex({i,j})).velocity.y += div*sBottom;
-                    fluidGrid.at(gridCoordIndex({i,j+1})).velocity.y -= div*sTop;
+        //relaxation starts from the last step's pressure too: apply its gradient, then the sweeps correct it further
+        if(config.warmStartPressure) applyPressureGradient();
+        //sweep until the divergence error is below relaxTolerance, or relaxIters times when no tolerance is set
+        int iter {};
+        float residual {};
+        while(iter<config.relaxIters){
+            iter++;
+            if(config.solver == RED_BLACK){
+                relaxGrid grid {fluidGrid.u.data(),fluidGrid.v.data(),pressure.data(),fluidGrid.density.data(),
+                                fluidGrid.openLeft.data(),fluidGrid.openRight.data(),fluidGrid.openBottom.data(),
+                                fluidGrid.openTop.data(),fluidGrid.invOpenCount.data(),
+                                restDensity,config.overrelax,config.compressionFactor};
+                for(int colour{};colour<2;colour++){
+                    const relaxColourCells &cells {colourWaterCells[colour]};
+                    int numBlocks {(cells.size()+RELAX_GRAIN-1)/RELAX_GRAIN};
+                    threadPool.parallelFor(0,numBlocks,[&](int block){
+                        int begin {block*RELAX_GRAIN}, end {std::min(cells.size(),begin+RELAX_GRAIN)};
+                        relaxCorrections(grid,cells,begin,end,relaxDelta.data());
+                        applyRelaxCorrections(grid,cells,begin,end,relaxDelta.data());
+                    });
+                }
+            } else {
+                for(glm::ivec2 cell:waterCells){
+                    relaxCell(cell.x,cell.y);
                 }
             }
+            if(config.relaxTolerance > 0.0f){
+                residual = relaxResidual();
+                if(residual <= config.relaxTolerance) break;
+            }
         }
-
+        if(config.relaxTolerance <= 0.0f) residual = relaxResidual();
+        lastPressureSolve = {iter,residual};
     }
 
-    void computeDensities(){
-        //clear densities;
-        for(int i{};i<fluidGrid.size();i++){
-            fluidGrid.at(i).density = 0.0f;
+    //solve for the pressure that leaves every water cell with only the drift correction as divergence, starting from
+    //the pressure already in the field, then subtract its gradient from the face velocities. Faces touching solids
+    //or between two air cells are not changed.
+    void solvePressure(){
+        const float *u {fluidGrid.u.data()}, *v {fluidGrid.v.data()};
+        const cellType *type {fluidGrid.type.data()};
+        for(glm::ivec2 cell:waterCells){
+            int c {gridCoordIndex(cell)};
+            float div {u[gridCoordIndex({cell.x+1,cell.y})] - u[c] + v[gridCoordIndex({cell.x,cell.y+1})] - v[c]};
+            //adjust for drift
+            float compression {fluidGrid.density[c] - restDensity};
+            float target {compression>0.0f ? config.compressionFactor*compression : 0.0f};
+            pressureRhs[c] = target - div;
+        }
+        poissonProblem problem {gridDimensions,&gridIndexing,type,fluidGrid.openFaces.data(),pressureRhs.data(),
+                                waterCells.data(),static_cast<int>(waterCells.size())};
+        if(config.solver == MULTIGRID){
+            lastPressureSolve = multigridSolver.solve(problem,pressure.data(),config.pressureTolerance,config.multigridMaxIters);
+        } else {
+            lastPressureSolve = pcgSolver.solve(problem,pressure.data(),config.pressureTolerance,config.pressureMaxIters);
         }
+        applyPressureGradient();
+    }
 
-        //calculate weights
-        for(int i{};i<NUM_PARTICLES;i++){
-            glm::vec2 pos {particles.at(i).position.x,particles.at(i).position.y}; 
-            pos -= glm::vec2({spacing/2.0f,spacing/2.0f}); //shift both coordinates so we calulate density at the center of each cell
-            pos.x = glm::clamp(pos.x,spacing,spacing*(gridDimensions.x-1)); //keep pos in bounds
-            pos.y = glm::clamp(pos.y,spacing,spacing*(gridDimensions.y-1));
-            //coords of 4 surrounding cells
-            glm::ivec2 q0{getGridCoords(pos)};
-            glm::ivec2 q1{std::min(q0.x+1,gridDimensions.x-2),q0.y};
-            glm::ivec2 q2{q1.x,std::min(q1.y+1,gridDimensions.y-2)};
-            glm::ivec2 q3{q0.x,std::min(q0.y+1,gridDimensions.y-2)};
-            int i0{gridCoordIndex(q0)},i1{gridCoordIndex(q1)},i2{gridCoordIndex(q2)},i3{gridCoordIndex(q3)}; //fluidGrid indices for cells
-            float dx{pos.x-q0.x*spacing}, dy{pos.y-q0.y*spacing}; //here the repeated parts of the bilinear interp values are calculated
-            float sx {dx/spacing}, sy{dy/spacing};
-            float tx {1-sx}, ty {1-sy};
-            float w0{tx*ty}, w1{sx*ty}, w2{sx*sy} ,w3{tx*sy}; //weights
-
-            //sum weights to get densities
-            fluidGrid.at(i0).density += w0;
-            fluidGrid.at(i1).density += w1;
-            fluidGrid.at(i2).density += w2;
-            fluidGrid.at(i3).density += w3;
+    //u -= p_c - p_left, v -= p_c - p_bottom on every open face next to water. Each water cell does its left and
+    //bottom faces, and its right and top faces when they lead into air (a water neighbour does those itself).
+    void applyPressureGradient(){
+        float *u {fluidGrid.u.data()}, *v {fluidGrid.v.data()};
+        const cellType *type {fluidGrid.type.data()};
+        for(glm::ivec2 cell:waterCells){
+            int c {gridCoordIndex(cell)};
+            int left {gridCoordIndex({cell.x-1,cell.y})}, right {gridCoordIndex({cell.x+1,cell.y})};
+            int bottom {gridCoordIndex({cell.x,cell.y-1})}, top {gridCoordIndex({cell.x,cell.y+1})};
+            if(type[left]!=SOLID) u[c] -= pressure[c] - pressure[left];
+            if(type[right]==AIR) u[right] -= pressure[right] - pressure[c];
+            if(type[bottom]!=SOLID) v[c] -= pressure[c] - pressure[bottom];
+            if(type[top]==AIR) v[top] -= pressure[top] - pressure[c];
         }
-        
-        //On first execution we set the initial density
-        if (restDensity==0.0f){
-            float densitySum{};
-            int numWater {};
-            for(int i{};i<fluidGrid.size();i++){
-                if(fluidGrid.at(i).type == WATER){
-                    densitySum += fluidGrid.at(i).density;
-                    numWater++; //count number of water cells
-                }
-            }
-            if(numWater!=0.0f) restDensity = densitySum/numWater;
+    }
+
+    //largest difference between a water cell's divergence and the drift correction it is relaxed towards,
+    //the same quantity the PCG and multigrid solves report as their residual
+    float relaxResidual() const{
+        const float *u {fluidGrid.u.data()}, *v {fluidGrid.v.data()};
+        float residual {};
+        for(glm::ivec2 cell:waterCells){
+            int c {gridCoordIndex(cell)};
+            float div {u[gridCoordIndex({cell.x+1,cell.y})] - u[c] + v[gridCoordIndex({cell.x,cell.y+1})] - v[c]};
+            float compression {fluidGrid.density[c] - restDensity};
+            float target {compression>0.0f ? config.compressionFactor*compression : 0.0f};
+            residual = std::max(residual,std::abs(div-target));
         }
+        return residual;
+    }
 
+    //remove the (over relaxed) divergence of water cell i,j by adjusting the velocities on its four faces, one cell
+    //of the Gauss-Seidel sweep. Red black half sweeps do the same update in two passes, see PressureRelax.h
+    void relaxCell(int i, int j){
+        int c {gridCoordIndex({i,j})};
+        float *u {fluidGrid.u.data()}, *v {fluidGrid.v.data()};
+        int right {gridCoordIndex({i+1,j})}, top {gridCoordIndex({i,j+1})};
+        float div {u[right] - u[c] + v[top] - v[c]};
+        div *= config.overrelax;
+        //adjust for drift
+        float compression = fluidGrid.density[c] - restDensity;
+        div -= config.compressionFactor*std::max(compression,0.0f);
+        div *= fluidGrid.invOpenCount[c]; //zero for a cell walled in on every side, which then stays unchanged
+        pressure[c] -= div; //the face updates below are the gradient of this pressure change
+        u[c] += div*fluidGrid.openLeft[c];
+        u[right] -= div*fluidGrid.openRight[c];
+        v[c] += div*fluidGrid.openBottom[c];
+        v[top] -= div*fluidGrid.openTop[c];
+    }
 
+    //call after changing which cells are solid, rebuilds the cached projection stencil
+    void solidsChanged(){
+        const cellType *type {fluidGrid.type.data()};
+        for(int i{};i<gridDimensions.x;i++){
+            for(int j{};j<gridDimensions.y;j++){
+                int c {gridCoordIndex({i,j})};
+                unsigned char open = (type[gridCoordIndex({i-1,j})]!=SOLID?FluidGrid::OPEN_LEFT:0) |
+                                     (type[gridCoordIndex({i+1,j})]!=SOLID?FluidGrid::OPEN_RIGHT:0) |
+                                     (type[gridCoordIndex({i,j-1})]!=SOLID?FluidGrid::OPEN_BOTTOM:0) |
+                                     (type[gridCoordIndex({i,j+1})]!=SOLID?FluidGrid::OPEN_TOP:0);
+                fluidGrid.openFaces[c] = open;
+                fluidGrid.openLeft[c] = open & FluidGrid::OPEN_LEFT ? 1.0f : 0.0f;
+                fluidGrid.openRight[c] = open & FluidGrid::OPEN_RIGHT ? 1.0f : 0.0f;
+                fluidGrid.openBottom[c] = open & FluidGrid::OPEN_BOTTOM ? 1.0f : 0.0f;
+                fluidGrid.openTop[c] = open & FluidGrid::OPEN_TOP ? 1.0f : 0.0f;
+                fluidGrid.invOpenCount[c] = open ? 1.0f/FluidGrid::openCount(open) : 0.0f;
+            }
+        }
     }
 
     void colorParticles(){
-        for(int i{};i<NUM_PARTICLES;i++){
-            int gridIndex = gridCoordIndex(getGridCoords(particles.at(i).position));
-            if(restDensity>0){
-                float speedSquared {glm::dot(particles.at(i).velocity,particles.at(i).velocity)};
-                if(speedSquared>20.0f && (fluidGrid.at(gridIndex).density/restDensity)<0.7){
-                    particles.at(i).color = {0.8f,0.8f,1.0f};
-                } else if (speedSquared <30.0f){
-                    particles.at(i).color += 0.1f*(glm::mix(WATER_COLOR,particles.at(i).color,speedSquared/30.0f)-particles.at(i).color);
-                }
+        PHASE_TIMER(phaseTimings,PHASE_COLOR_PARTICLES);
+        if(restDensity<=0) return;
+        int n {particles.size()};
+        const float *x {particles.x.data()}, *y {particles.y.data()};
+        const float *vx {particles.vx.data()}, *vy {particles.vy.data()};
+        glm::vec3 *color {particles.color.data()};
+        for(int i{};i<n;i++){
+            int gridIndex = gridCoordIndex(getGridCoords({x[i],y[i]}));
+            float speedSquared {vx[i]*vx[i] + vy[i]*vy[i]};
+            if(speedSquared>20.0f && (fluidGrid.density[gridIndex]/restDensity)<0.7){
+                color[i] = {0.8f,0.8f,1.0f};
+            } else if (speedSquared <30.0f){
+                color[i] += 0.1f*(glm::mix(WATER_COLOR,color[i],speedSquared/30.0f)-color[i]);
             }
         }
     }
@@ -0,0 +1,194 @@
+#ifndef _SIMULATION_CONFIG_H_
+#define _SIMULATION_CONFIG_H_
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <vector>
+
+//defaults
+const int NUM_PARTICLES = 7000;
+const glm::ivec2 GRID_DIMENSIONS = glm::ivec2(200,80);
+const float SPACING = 1.1f;
+const float GRAVITY = -9.81f;
+const int PUSH_APART_ITERS = 2; //number of iterations to repeat pushApart
+const int RELAX_ITERS = 2; //Gauss-Seidel or red black sweeps per step, the cap when RELAX_TOLERANCE is set
+const float RELAX_TOLERANCE = 0.0f; //stop sweeping once the largest divergence error is below this, 0 always does RELAX_ITERS
+const float FLIP_PIC_RATIO = 0.7f;
+const float OVERRELAX = 1.9f;
+const float COMPRESSION_FACTOR = 5.0f;
+const float MOUSE_OBSTACLE_RADIUS = 7.0f;
+const float TIME_SCALE = 1.5f;
+const int REORDER_INTERVAL = 32; //steps (not substeps) between sorting the particle arrays into cell order, 0 never sorts
+const float PRESSURE_TOLERANCE = 1e-3f; //largest divergence error left by the PCG solve
+const int PRESSURE_MAX_ITERS = 200; //cap on PCG iterations
+const int MULTIGRID_MAX_ITERS = 50; //cap on multigrid preconditioned CG iterations
+const float FIXED_TIMESTEP = 1.0f/60.0f; //seconds of frame time advance() covers with one step, before timeScale
+const float CFL_NUMBER = 2.0f; //most grid cells a particle may travel in one substep, 0 never substeps
+const int MAX_SUBSTEPS = 8; //cap on the substeps one step is split into
+const int MAX_STEPS_PER_FRAME = 4; //cap on the steps one advance() call takes, frame time beyond it is dropped
+
+//order in which makeIncompressible relaxes the water cells
+//GAUSS_SEIDEL: column by column in place, serial
+//RED_BLACK: checkerboard half sweeps, cells of one colour share no faces so each half sweep runs on the thread pool
+//PCG: solve the pressure Poisson equation with preconditioned conjugate gradients to PRESSURE_TOLERANCE
+//MULTIGRID: solve the same equation with multigrid V-cycle preconditioned CG, cost grows about linearly with the grid
+enum pressureSolver {GAUSS_SEIDEL, RED_BLACK, PCG, MULTIGRID};
+
+const char* const PRESSURE_SOLVER_NAMES[] = {"gs", "rb", "pcg", "mg"};
+
+//Everything that sizes or tunes a Simulation. Values come from the defaults above, a config file of
+//"key = value" lines (# starts a comment) or --key=value command line arguments, keys are the member names.
+//numParticles, gridDimensions, spacing and numThreads only take effect through Simulation::configure,
+//the rest can be changed between steps.
+struct SimulationConfig{
+    int numParticles {NUM_PARTICLES};
+    glm::ivec2 gridDimensions {GRID_DIMENSIONS}; //written as <x>x<y>, e.g. 200x80
+    float spacing {SPACING}; //size of one grid cell
+    float gravity {GRAVITY};
+    int pushApartIters {PUSH_APART_ITERS};
+    int relaxIters {RELAX_ITERS};
+    float relaxTolerance {RELAX_TOLERANCE};
+    float flipPicRatio {FLIP_PIC_RATIO};
+    float overrelax {OVERRELAX};
+    float compressionFactor {COMPRESSION_FACTOR};
+    float mouseObstacleRadius {MOUSE_OBSTACLE_RADIUS};
+    float timeScale {TIME_SCALE};
+    int numThreads {}; //counts the calling thread, 0 uses every hardware thread
+    bool parallelPushApart {true}; //separate particles tile by tile on the thread pool instead of the serial particle loop
+    bool parallelTransfer {true}; //scatter particles to the grid strip by strip on the thread pool, same result for any thread count
+    int reorderInterval {REORDER_INTERVAL};
+    pressureSolver solver {GAUSS_SEIDEL}; //gs, rb, pcg or mg
+    float pressureTolerance {PRESSURE_TOLERANCE};
+    int pressureMaxIters {PRESSURE_MAX_ITERS};
+    int multigridMaxIters {MULTIGRID_MAX_ITERS};
+    //start each pressure solve from the previous step's pressure instead of zero. Off by default: FLIP grid velocities
+    //already carry the last correction, so the density drift term dominates and the pressure changes every step.
+    bool warmStartPressure {false};
+    float fixedTimestep {FIXED_TIMESTEP};
+    int maxStepsPerFrame {MAX_STEPS_PER_FRAME};
+    float cflNumber {CFL_NUMBER};
+    int maxSubsteps {MAX_SUBSTEPS};
+
+    //set one value by name, prints an error and returns false for unknown keys or unparsable values
+    bool set(const std::string &key, const std::string &value){
+        try {
+            if(key == "numParticles") numParticles = std::stoi(value);
+            else if(key == "gridDimensions") gridDimensions = parseDimensions(value);
+            else if(key == "spacing") spacing = std::stof(value);
+            else if(key == "gravity") gravity = std::stof(value);
+            else if(key == "pushApartIters") pushApartIters = std::stoi(value);
+            else if(key == "relaxIters") relaxIters = std::stoi(value);
+            else if(key == "relaxTolerance") relaxTolerance = std::stof(value);
+            else if(key == "flipPicRatio") flipPicRatio = std::stof(value);
+            else if(key == "overrelax") overrelax = std::stof(value);
+            else if(key == "compressionFactor") compressionFactor = std::stof(value);
+            else if(key == "mouseObstacleRadius") mouseObstacleRadius = std::stof(value);
+            else if(key == "timeScale") timeScale = std::stof(value);
+            else if(key == "numThreads") numThreads = std::stoi(value);
+            else if(key == "parallelPushApart") parallelPushApart = parseBool(value);
+            else if(key == "parallelTransfer") parallelTransfer = parseBool(value);
+            else if(key == "reorderInterval") reorderInterval = std::stoi(value);
+            else if(key == "solver") solver = parseSolver(value);
+            else if(key == "pressureTolerance") pressureTolerance = std::stof(value);
+            else if(key == "pressureMaxIters") pressureMaxIters = std::stoi(value);
+            else if(key == "multigridMaxIters") multigridMaxIters = std::stoi(value);
+            else if(key == "warmStartPressure") warmStartPressure = parseBool(value);
+            else if(key == "fixedTimestep") fixedTimestep = std::stof(value);
+            else if(key == "maxStepsPerFrame") maxStepsPerFrame = std::stoi(value);
+            else if(key == "cflNumber") cflNumber = std::stof(value);
+            else if(key == "maxSubsteps") maxSubsteps = std::stoi(value);
+            else {
+                std::cout << "ERROR unknown config key \'" << key << "\'" << std::endl;
+                return false;
+            }
+        }
+        catch (std::exception &e)
+        {
+            std::cout << "ERROR bad value \'" << value << "\' for config key \'" << key << "\'" << std::endl;
+            return false;
+        }
+        return valid();
+    }
+
+    bool loadFile(const std::string &path){
+        std::ifstream file(path);
+        if(!file){
+            std::cout << "ERROR CONFIG FILE \'" << path << "\' COULD NOT BE READ" << std::endl;
+            return false;
+        }
+        std::string line;
+        int lineNumber {};
+        while(std::getline(file,line)){
+            lineNumber++;
+            line = line.substr(0,line.find('#'));
+            if(trim(line).empty()) continue;
+            size_t equals {line.find('=')};
+            if(equals == std::string::npos){
+                std::cout << "ERROR " << path << ":" << lineNumber << " expected key = value" << std::endl;
+                return false;
+            }
+            if(!set(trim(line.substr(0,equals)),trim(line.substr(equals+1)))) return false;
+        }
+        return true;
+    }
+
+    //applies --key=value and --config=<file> arguments in order, anything else is appended to unused
+    bool parseArgs(int argc, char* argv[], std::vector<std::string> &unused){
+        for(int i{1};i<argc;i++){
+            std::string arg {argv[i]};
+            size_t equals {arg.find('=')};
+            if(arg.rfind("--",0) != 0 || equals == std::string::npos){
+                unused.push_back(arg);
+                continue;
+            }
+            std::string key {arg.substr(2,equals-2)}, value {arg.substr(equals+1)};
+            bool ok {key == "config" ? loadFile(value) : set(key,value)};
+            if(!ok) return false;
+        }
+        return true;
+    }
+
+    bool valid() const{
+        if(numParticles < 0 || gridDimensions.x < 3 || gridDimensions.y < 3 || spacing <= 0.0f){
+            std::cout << "ERROR config needs numParticles >= 0, a grid of at least 3x3 cells and spacing > 0" << std::endl;
+            return false;
+        }
+        if(fixedTimestep <= 0.0f || maxStepsPerFrame < 1 || cflNumber < 0.0f || maxSubsteps < 1){
+            std::cout << "ERROR config needs fixedTimestep > 0, cflNumber >= 0 and maxStepsPerFrame, maxSubsteps >= 1" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static std::string trim(const std::string &s){
+        size_t first {s.find_first_not_of(" \t\r")};
+        if(first == std::string::npos) return "";
+        return s.substr(first,s.find_last_not_of(" \t\r")-first+1);
+    }
+
+    static glm::ivec2 parseDimensions(const std::string &value){
+        size_t x {value.find('x')};
+        if(x == std::string::npos) throw std::invalid_argument(value);
+        return {std::stoi(value.substr(0,x)),std::stoi(value.substr(x+1))};
+    }
+
+    static bool parseBool(const std::string &value){
+        if(value == "true" || value == "1") return true;
+        if(value == "false" || value == "0") return false;
+        throw std::invalid_argument(value);
+    }
+
+    static pressureSolver parseSolver(const std::string &value){
+        for(int s{};s<=MULTIGRID;s++){
+            if(value == PRESSURE_SOLVER_NAMES[s]) return static_cast<pressureSolver>(s);
+        }
+        throw std::invalid_argument(value);
+    }
+};
+
+#endif
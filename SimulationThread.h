@@ -0,0 +1,147 @@
+#ifndef _SIMULATION_THREAD_H_
+#define _SIMULATION_THREAD_H_
+
+#include <glm/glm.hpp>
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#include "Simulation.h"
+#include "TripleBuffer.h"
+
+//one particle as the renderer draws it, the vertex shader blends prevPosition to position
+struct particleInstance{
+    glm::vec2 prevPosition; //before the last step
+    glm::vec2 position;
+    glm::vec3 color;
+};
+
+//everything the renderer needs from one published state of the simulation
+struct simulationSnapshot{
+    particleInstance *instances {}; //memory the renderer draws from (a mapped GPU buffer), see setInstanceBuffers
+    int buffer {};                  //which of the renderer's buffers instances points into
+    int numParticles {};
+    glm::vec2 obstaclePosition {};
+    float obstacleRadius {};
+    glm::vec3 obstacleColor {};
+    double time {}; //SimulationThread::now() when the last step finished
+    float fixedTimestep {1.0f};
+
+    //how far to blend from the previous positions to the current ones when drawing at renderTime. Drawing one step
+    //behind the simulation keeps the motion smooth even though steps and frames finish at unrelated times.
+    float interpolationAlpha(double renderTime) const {
+        return glm::clamp(static_cast<float>((renderTime-time)/fixedTimestep),0.0f,1.0f);
+    }
+};
+
+//Runs a Simulation on its own thread in real time (Simulation::advance with the wall clock) so solving and
+//presenting frames no longer wait on each other. After every batch of steps the particles are written once, straight
+//into the memory the renderer draws from, and the snapshot is published through a TripleBuffer. The render thread
+//reads the newest one without locking. Each of the three snapshots owns one of the renderer's buffers, and the renderer
+//has to be done drawing a buffer before consuming a newer snapshot hands it back, see latest().
+//The mouse position is the only input and is passed in through an atomic.
+//While running, the simulation must not be touched from any other thread.
+class SimulationThread {
+public:
+    explicit SimulationThread(Simulation &simulation) : sim(simulation) {}
+
+    ~SimulationThread(){
+        stop();
+    }
+
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    //seconds on the clock snapshots are stamped with
+    static double now(){
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //buffers[k] takes snapshot k's particles, room for capacity particles each. Call before start(). Without
+    //buffers only the rest of the snapshot is published.
+    void setInstanceBuffers(void* const buffers[3], int capacity){
+        for(int k{};k<3;k++){
+            snapshots.slot(k).instances = static_cast<particleInstance*>(buffers[k]);
+            snapshots.slot(k).buffer = k;
+        }
+        instanceCapacity = capacity;
+    }
+
+    //publishes the current state, so latest() has something to draw straight away, and starts stepping
+    void start(){
+        if(running) return;
+        mousePosition.store(sim.mouseObstacle.position,std::memory_order_relaxed);
+        publish(now());
+        running = true;
+        thread = std::thread(&SimulationThread::run,this);
+    }
+
+    void stop(){
+        running = false;
+        if(thread.joinable()) thread.join();
+    }
+
+    void setMousePosition(glm::vec2 position){
+        mousePosition.store(position,std::memory_order_relaxed);
+    }
+
+    //newest published snapshot, stays valid and unchanged until the next call. Taking a newer one hands the buffer of
+    //the current one back to the simulation thread, so waitForBuffer(buffer) is called first and must return only once
+    //the GPU is done reading it. Only this side clears the published flag, so the snapshot checked here is the one taken.
+    template<typename WaitForBuffer>
+    const simulationSnapshot& latest(WaitForBuffer &&waitForBuffer){
+        if(snapshots.published()){
+            waitForBuffer(snapshots.front().buffer);
+            snapshots.consume();
+        }
+        return snapshots.front();
+    }
+
+private:
+    Simulation &sim;
+    TripleBuffer<simulationSnapshot> snapshots;
+    std::atomic<glm::vec2> mousePosition {glm::vec2(0.0f)};
+    std::atomic<bool> running {false};
+    std::thread thread;
+    int instanceCapacity {};
+
+    void run(){
+        double lastTime {now()};
+        while(running){
+            double time {now()};
+            sim.mouseObstacle.position = mousePosition.load(std::memory_order_relaxed);
+            int steps {sim.advance(static_cast<float>(time-lastTime))};
+            lastTime = time;
+            if(steps > 0){
+                publish(now());
+            } else {
+                //nothing was due, sleep until the next step is
+                float untilNextStep {(1.0f-sim.interpolationAlpha())*sim.config.fixedTimestep};
+                std::this_thread::sleep_for(std::chrono::duration<float>(untilNextStep));
+            }
+        }
+    }
+
+    void publish(double time){
+        simulationSnapshot &snapshot {snapshots.back()};
+        const ParticleArrays &particles {sim.particles};
+        snapshot.numParticles = 0;
+        if(snapshot.instances != nullptr){
+            snapshot.numParticles = std::min(particles.size(),instanceCapacity);
+            particleInstance *instances {snapshot.instances};
+            for(int i{};i<snapshot.numParticles;i++){
+                instances[i] = {{particles.prevX[i],particles.prevY[i]},{particles.x[i],particles.y[i]},particles.color[i]};
+            }
+        }
+        snapshot.obstaclePosition = sim.mouseObstacle.position;
+        snapshot.obstacleRadius = sim.mouseObstacle.radius;
+        snapshot.obstacleColor = sim.mouseObstacle.color;
+        snapshot.time = time;
+        snapshot.fixedTimestep = sim.config.fixedTimestep;
+        snapshots.publish();
+    }
+};
+
+#endif
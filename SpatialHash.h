@@ -0,0 +1,64 @@
+#ifndef _SPATIAL_HASH_H_
+#define _SPATIAL_HASH_H_
+
+#include <vector>
+#include <algorithm>
+
+//Counting sort of particles into grid cells. Buffers are kept between rebuilds and only grow when the
+//cell or particle count does, so rebuilding every step does not allocate.
+//After build(), particles in cell c are particleIDs[cellStart[c]] .. particleIDs[cellStart[c+1]-1].
+class SpatialHash {
+public:
+    std::vector<int> cellStart;     //first slot of each cell in particleIDs, plus a guard holding the particle count
+    std::vector<int> particleIDs;   //indices of particles arranged by cell
+    std::vector<int> particleCells; //cell of every particle as of the last build
+
+    void resize(int numCells, int numParticles){
+        cellStart.resize(numCells+1);
+        particleIDs.resize(numParticles);
+        particleCells.resize(numParticles);
+    }
+
+    int numCells() const { return static_cast<int>(cellStart.size())-1; }
+
+    int cellBegin(int cell) const { return cellStart[cell]; }
+    int cellEnd(int cell) const { return cellStart[cell+1]; }
+
+    //call after the particles themselves were permuted into particleIDs order, the sort then becomes the identity
+    void particlesReordered(){
+        int numParticles {static_cast<int>(particleIDs.size())};
+        for(int c{};c<numCells();c++){
+            for(int k{cellStart[c]};k<cellStart[c+1];k++)
+                particleCells[k] = c;
+        }
+        for(int k{};k<numParticles;k++)
+            particleIDs[k] = k;
+    }
+
+    //cellOf(i) returns the cell index of particle i, it is called exactly once per particle
+    template<typename CellOf>
+    void build(int numParticles, CellOf cellOf){
+        if(static_cast<int>(particleIDs.size()) != numParticles)
+            resize(numCells(),numParticles);
+        std::fill(cellStart.begin(),cellStart.end(),0);
+        //count number of particles in each cell
+        for(int i{};i<numParticles;i++){
+            int cell {cellOf(i)};
+            particleCells[i] = cell;
+            cellStart[cell]++;
+        }
+        //insert running total particle counts
+        int current {};
+        for(int c{};c<numCells();c++){
+            current += cellStart[c];
+            cellStart[c] = current;
+        }
+        cellStart[numCells()] = numParticles; //guard
+        //fill particleIDs walking the running totals back down to each cell's start
+        for(int i{};i<numParticles;i++){
+            particleIDs[--cellStart[particleCells[i]]] = i;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+//Persistent worker threads for the simulation's data parallel loops. parallelFor splits a range into chunks
+//that the workers and the calling thread pull from a shared counter, and returns once every chunk is done.
+//Jobs are passed as a function pointer plus context so dispatching a loop does not allocate.
+class ThreadPool {
+public:
+    //numThreads counts the calling thread, 0 uses every hardware thread
+    explicit ThreadPool(int numThreads = 0){
+        startWorkers(numThreads);
+    }
+
+    ~ThreadPool(){
+        stopWorkers();
+    }
+
+    //joins the current workers and starts a new set, must not be called from inside parallelFor
+    void setNumThreads(int numThreads){
+        stopWorkers();
+        startWorkers(numThreads);
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    //calls fn(i) for every i in [begin,end). Iterations are grouped into chunks of grain items.
+    template<typename F>
+    void parallelFor(int begin, int end, F &&fn, int grain = 1){
+        if(end <= begin) return;
+        grain = std::max(grain,1);
+        if(workers.empty() || end-begin <= grain){
+            for(int i{begin};i<end;i++) fn(i);
+            return;
+        }
+        using Fn = typename std::remove_reference<F>::type;
+        run(begin,end,grain,[](void *context, int lo, int hi){
+            Fn &f {*static_cast<Fn*>(context)};
+            for(int i{lo};i<hi;i++) f(i);
+        },static_cast<void*>(&fn));
+    }
+
+private:
+    using chunkFunction = void(*)(void*,int,int);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stopping {false};
+    unsigned long generation {}; //bumped for every job so sleeping workers notice new work
+
+    //current job
+    chunkFunction job {nullptr};
+    void *jobContext {nullptr};
+    int jobEnd {}, jobGrain {1};
+    std::atomic<int> nextIndex {0};
+    int busyWorkers {};
+
+    void startWorkers(int numThreads){
+        if(numThreads <= 0)
+            numThreads = std::max(1u,std::thread::hardware_concurrency());
+        stopping = false;
+        unsigned long current {generation}; //no job is running here, so workers start level with the last one
+        for(int i{1};i<numThreads;i++){
+            workers.emplace_back([this,current]{ workerLoop(current); });
+        }
+    }
+
+    void stopWorkers(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(auto &worker:workers)
+            worker.join();
+        workers.clear();
+    }
+
+    void run(int begin, int end, int grain, chunkFunction function, void *context){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = function;
+            jobContext = context;
+            jobEnd = end;
+            jobGrain = grain;
+            nextIndex.store(begin,std::memory_order_relaxed);
+            busyWorkers = static_cast<int>(workers.size());
+            generation++;
+        }
+        wake.notify_all();
+        runChunks(function,context,end,grain);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock,[this]{ return busyWorkers == 0; });
+    }
+
+    void runChunks(chunkFunction function, void *context, int end, int grain){
+        for(;;){
+            int lo {nextIndex.fetch_add(grain,std::memory_order_relaxed)};
+            if(lo >= end) return;
+            function(context,lo,std::min(lo+grain,end));
+        }
+    }
+
+    void workerLoop(unsigned long seen){
+        for(;;){
+            chunkFunction function;
+            void *context;
+            int end, grain;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock,[&]{ return stopping || generation != seen; });
+                if(stopping) return;
+                seen = generation;
+                function = job;
+                context = jobContext;
+                end = jobEnd;
+                grain = jobGrain;
+            }
+            runChunks(function,context,end,grain);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                busyWorkers--;
+            }
+            done.notify_one();
+        }
+    }
+};
+
+#endif
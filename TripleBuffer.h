@@ -0,0 +1,48 @@
+#ifndef _TRIPLE_BUFFER_H_
+#define _TRIPLE_BUFFER_H_
+
+#include <atomic>
+
+//Lock free single producer, single consumer triple buffer. The producer fills back() and publish()es it, the consumer
+//takes the newest published slot with consume() and reads front(). The three slots never alias, so neither side
+//ever waits for the other and a slow consumer simply skips the slots it never saw.
+template<typename T>
+class TripleBuffer {
+public:
+    //producer side: the slot to fill next
+    T& back() { return slots[backIndex]; }
+
+    //producer side: hand back() to the consumer and take the slot it replaced
+    void publish(){
+        backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    //consumer side: true if consume() would move to a newer slot and hand front() back to the producer
+    bool published() const {
+        return middle.load(std::memory_order_acquire) & FRESH;
+    }
+
+    //consumer side: move to the newest published slot, false if nothing was published since the last call
+    bool consume(){
+        if(!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    //consumer side: the slot taken by the last consume()
+    const T& front() const { return slots[frontIndex]; }
+
+    //slot k of 3, only for setting the slots up before the producer and consumer start
+    T& slot(int k) { return slots[k]; }
+
+private:
+    static const int INDEX_MASK = 3;
+    static const int FRESH = 4; //set in middle when it holds a slot the consumer has not taken yet
+
+    T slots[3];
+    int backIndex {0};  //only touched by the producer
+    int frontIndex {1}; //only touched by the consumer
+    std::atomic<int> middle {2};
+};
+
+#endif
@@ -9,11 +9,14 @@
 #include "stb_image.h"
 #include "camera.h"
 #include "Simulation.h"
+#include "SimulationThread.h"
+#include "BufferRing.h"
 
 #include <iostream>
 #include <cmath>
 #include <string>
 #include <vector>
+#include <cstddef>
 
 using std::sin;
 
@@ -22,7 +25,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow *window, float deltaTime);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 unsigned int loadTexture(const std::string path);
-void drawBalls(std::vector<Particle> particles);
+void drawBalls(const simulationSnapshot &snapshot, float alpha);
 void drawBalls(std::vector<glm::vec2> positions,float radius, glm::vec3 color);
 void drawLine(glm::vec2 p1 , glm::vec2 p2);
 
@@ -36,11 +39,27 @@ unsigned int textureCount {0};
 Camera camera;
 Shader ballShader;
 Shader lineShader;
+UniformBuffer cameraUniforms; //view and projection for every shader, the CameraMatrices block in vertex.vert
+const unsigned int CAMERA_UNIFORM_BINDING = 0;
 
 Simulation sim;
+SimulationThread simThread(sim); //steps sim in real time on its own thread, the render loop only reads its snapshots
 
-int main()
+const unsigned int INSTANCE_BINDING = 1; //quadVAO vertex buffer binding the particleInstance attributes read from
+PersistentBufferRing instanceRing; //simThread writes particleInstances straight into these, one buffer per snapshot
+
+int main(int argc, char* argv[])
 {
+    //simulation size and tuning from --key=value arguments or --config=<file>, see SimulationConfig.h
+    SimulationConfig config;
+    std::vector<std::string> unusedArgs;
+    if(!config.parseArgs(argc,argv,unusedArgs)) return -1;
+    for(const std::string &arg:unusedArgs){
+        std::cout << "ERROR unexpected argument \'" << arg << "\'" << std::endl;
+        return -1;
+    }
+    sim.configure(config);
+
     //Window setup
     GLFWwindow* window = setupWindow();
     if (window==NULL){
@@ -100,6 +119,25 @@ int main()
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0); 
 
+    //per instance particle position, colour and position before the last step, advanced once per quad. They read
+    //from INSTANCE_BINDING, which drawBalls points at the buffer of the snapshot it draws. Every buffer holds at
+    //least one instance so the attributes always point at valid memory, non instanced draws ignore them.
+    int instanceCapacity {std::max(sim.particles.size(),1)};
+    instanceRing.init(instanceCapacity*sizeof(particleInstance));
+    glVertexAttribFormat(1, 2, GL_FLOAT, GL_FALSE, offsetof(particleInstance,position));
+    glVertexAttribBinding(1, INSTANCE_BINDING);
+    glEnableVertexAttribArray(1);
+    glVertexAttribFormat(2, 3, GL_FLOAT, GL_FALSE, offsetof(particleInstance,color));
+    glVertexAttribBinding(2, INSTANCE_BINDING);
+    glEnableVertexAttribArray(2);
+    glVertexAttribFormat(3, 2, GL_FLOAT, GL_FALSE, offsetof(particleInstance,prevPosition));
+    glVertexAttribBinding(3, INSTANCE_BINDING);
+    glEnableVertexAttribArray(3);
+    glVertexBindingDivisor(INSTANCE_BINDING, 1);
+    glBindVertexBuffer(INSTANCE_BINDING, instanceRing.buffer(0), 0, sizeof(particleInstance));
+    void* instanceBuffers[BUFFER_RING_SIZE] {instanceRing.mapped(0), instanceRing.mapped(1), instanceRing.mapped(2)};
+    simThread.setInstanceBuffers(instanceBuffers, instanceCapacity);
+
     //LINE
     unsigned int lineVBO, lineVAO;
     glGenVertexArrays(1, &lineVAO);
@@ -114,6 +152,7 @@ int main()
     //=============SHADERS===============
     ballShader.genShaderProgram("vertex.vert", "fragment.frag");
     lineShader.genShaderProgram("vertex.vert", "line.frag");
+    cameraUniforms.create(2*sizeof(glm::mat4), CAMERA_UNIFORM_BINDING);
 
     //===========Transforms==============
    
@@ -124,14 +163,16 @@ int main()
     glm::mat4 projection = glm::mat4(1.0f);
 
     //===========Simulation==============
-    float gridSpacing = SPACING;
-    int gridx = GRID_DIMENSIONS.x;
-    int gridy = GRID_DIMENSIONS.y;
+    float gridSpacing = sim.config.spacing;
+    int gridx = sim.gridDimensions.x;
+    int gridy = sim.gridDimensions.y;
 
     //CAMERA
     camera.Position = glm::vec3(gridx/2, gridy/2, 250.0f);
     float lastTime {(float)glfwGetTime()};
 
+    simThread.start();
+
     //Render loop
     while(!glfwWindowShouldClose(window))
     {
@@ -145,52 +186,62 @@ int main()
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 
-        ballShader.use();
         projection = glm::perspective(glm::radians(camera.fov), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, camera.near, camera.far);
-        ballShader.setMat4("projection", projection);
         view = camera.GetViewMatrix();
-        ballShader.setMat4("view",view);
+        cameraUniforms.setMat4(0, view);
+        cameraUniforms.setMat4(sizeof(glm::mat4), projection);
+
+        ballShader.use();
         
-        sim.simulate(deltaTime);
+        //taking a newer snapshot hands the buffer drawn so far back to the simulation thread, the GPU has to be done with it
+        const simulationSnapshot &snapshot {simThread.latest([](int buffer){ instanceRing.wait(buffer); })};
 
         glBindVertexArray(quadVAO);
-        drawBalls(sim.particles);
-        drawBalls({sim.mouseObstacle.position},sim.mouseObstacle.radius, sim.mouseObstacle.color);
+        drawBalls(snapshot,snapshot.interpolationAlpha(SimulationThread::now()));
+        drawBalls({snapshot.obstaclePosition},snapshot.obstacleRadius, snapshot.obstacleColor);
 
         //draw lines for boundaries 
         lineShader.use();
-        lineShader.setMat4("projection", projection);
-        lineShader.setMat4("view",view);
         glBindVertexArray(lineVAO);
         drawLine({gridSpacing,gridSpacing},{gridx*gridSpacing-gridSpacing,gridSpacing}); //floor
         drawLine({gridSpacing,gridSpacing},{gridSpacing,gridy*gridSpacing-gridSpacing}); //left wall
         drawLine({gridSpacing,gridy*gridSpacing-gridSpacing},{gridx*gridSpacing-gridSpacing,gridy*gridSpacing-gridSpacing}); //ceiling
         drawLine({gridx*gridSpacing-gridSpacing,gridSpacing},{gridx*gridSpacing-gridSpacing,gridy*gridSpacing-gridSpacing}); //right wall
         
+        //every draw that reads this frame's instance buffer has been issued
+        instanceRing.fence(snapshot.buffer);
+
         glfwSwapBuffers(window);
         glfwPollEvents();    
     }
 
     //clean up
+    simThread.stop();
     glDeleteVertexArrays(1, &quadVAO);
     glDeleteBuffers(1, &quadVBO);
     glDeleteBuffers(1,&quadEBO);
+    instanceRing.destroy();
     glDeleteVertexArrays(1, &lineVAO);
     glDeleteBuffers(1, &lineVBO);
     ballShader.deleteProgram();
     lineShader.deleteProgram();
+    cameraUniforms.deleteBuffer();
       
     glfwTerminate();
     return 0;
 }
 
-void drawBalls(std::vector<Particle> particles){
-    for(auto const &particle: particles){
-        glm::mat4 model = glm::translate(glm::mat4(1.0f),glm::vec3(particle.position,0.0f));
-        ballShader.setMat4("model",model);
-        ballShader.setVec3("color", particle.color);
-        glDrawElements(GL_TRIANGLES,6,GL_UNSIGNED_INT,0);
-    }
+//draws every particle of the snapshot with one instanced call, quadVAO must be bound. The simulation thread already
+//wrote the instances into the snapshot's buffer, instanceRing.fence() has to follow once everything drawing from it
+//has been issued. alpha blends each particle between its last two simulated positions on the GPU,
+//see simulationSnapshot::interpolationAlpha
+void drawBalls(const simulationSnapshot &snapshot, float alpha){
+    glBindVertexBuffer(INSTANCE_BINDING, instanceRing.buffer(snapshot.buffer), 0, sizeof(particleInstance));
+    if(snapshot.numParticles == 0) return;
+    ballShader.setBool("instanced", true);
+    ballShader.setFloat("alpha", alpha);
+    glDrawElementsInstanced(GL_TRIANGLES,6,GL_UNSIGNED_INT,0,snapshot.numParticles);
+    ballShader.setBool("instanced", false);
 }
 
 void drawBalls(std::vector<glm::vec2> positions, float radius, glm::vec3 color){
@@ -247,7 +298,7 @@ void processInput(GLFWwindow *window, float deltaTime)
 void mouse_callback(GLFWwindow* window, double xpos, double ypos){
 
     float scale = 2.0f*camera.Position.z * std::tan(glm::radians(camera.fov/2))/SCREEN_HEIGHT;
-    sim.mouseObstacle.position = {scale*(xpos-(SCREEN_WIDTH/2)) + camera.Position.x,scale*(-ypos +(SCREEN_HEIGHT/2)) + camera.Position.y};
+    simThread.setMousePosition({scale*(xpos-(SCREEN_WIDTH/2)) + camera.Position.x,scale*(-ypos +(SCREEN_HEIGHT/2)) + camera.Position.y});
     //std::cout << scale*(xpos-(SCREEN_WIDTH/2)) + camera.Position.x <<", "<< scale*(-ypos +(SCREEN_HEIGHT/2)) + camera.Position.y << std::endl;
 }
 
@@ -0,0 +1,138 @@
+//headless benchmark: runs the simulation without a window and reports how long each step takes.
+//usage: fluidsim_bench [steps] [dt] [-v] [-t threads] [-serial] [-reorder interval] [-solver gs|rb|pcg|mg] [--key=value ...] [--config=file]
+//--key=value sets any SimulationConfig member, e.g. --numParticles=5000000 --gridDimensions=4000x2000
+
+#include "Simulation.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+
+const int DEFAULT_STEPS = 1000;
+const float DEFAULT_DT = 1.0f/60.0f;
+
+void printUsage(const char *program){
+    std::cout << "usage: " << program << " [steps] [dt] [-v] [-t threads] [-serial] [-reorder interval] [-solver gs|rb|pcg|mg]"
+              << " [--key=value ...] [--config=file]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    int steps {DEFAULT_STEPS};
+    float dt {DEFAULT_DT};
+    bool verbose {false};
+    SimulationConfig config;
+    std::vector<std::string> args;
+    if(!config.parseArgs(argc,argv,args)) return -1;
+
+    //positional arguments are steps then dt, -v prints every step, -t sets the thread count, -serial runs everything on one
+    //thread with the serial push apart and transfer loops (a later -t still sets the thread count),
+    //-reorder sets how many steps pass between sorting particles into cell order (0 never sorts),
+    //-solver picks the pressure solver
+    //the short options are kept as shorthands for the matching config keys
+    int positional {};
+    for(size_t i{};i<args.size();i++){
+        std::string arg {args[i]};
+        bool hasValue {i+1<args.size()};
+        if(arg == "-v"){
+            verbose = true;
+        } else if(arg == "-t" && hasValue){
+            if(!config.set("numThreads",args[++i])) return -1;
+        } else if(arg == "-serial"){
+            config.numThreads = 1;
+            config.parallelPushApart = false;
+            config.parallelTransfer = false;
+        } else if(arg == "-reorder" && hasValue){
+            if(!config.set("reorderInterval",args[++i])) return -1;
+        } else if(arg == "-solver" && hasValue){
+            if(!config.set("solver",args[++i])) return -1;
+        } else if(arg == "-h" || arg == "--help"){
+            printUsage(argv[0]);
+            return 0;
+        } else if(positional < 2){
+            //also where a flag missing its value ends up
+            try
+            {
+                if(positional == 0) steps = std::stoi(arg);
+                else dt = std::stof(arg);
+            }
+            catch (std::exception &e)
+            {
+                std::cout << "ERROR bad value \'" << arg << "\' for " << (positional == 0 ? "steps" : "dt") << std::endl;
+                printUsage(argv[0]);
+                return -1;
+            }
+            positional++;
+        } else {
+            std::cout << "ERROR unexpected argument \'" << arg << "\'" << std::endl;
+            return -1;
+        }
+    }
+    if(steps <= 0 || dt <= 0.0f){
+        std::cout << "ERROR steps and dt must be positive" << std::endl;
+        return -1;
+    }
+
+    Simulation sim(config);
+    std::vector<double> stepTimes(steps); //milliseconds
+    std::vector<pressureSolveResult> solves(steps); //iterations and residual of every step's last pressure solve
+    std::vector<int> substeps(steps);
+
+    auto totalStart = std::chrono::steady_clock::now();
+    for(int i{};i<steps;i++){
+        auto start = std::chrono::steady_clock::now();
+        sim.simulate(dt);
+        auto end = std::chrono::steady_clock::now();
+        stepTimes.at(i) = std::chrono::duration<double,std::milli>(end-start).count();
+        solves.at(i) = sim.lastPressureSolve;
+        substeps.at(i) = sim.lastSubsteps;
+        if(verbose)
+            std::cout << "step " << i << " " << stepTimes.at(i) << " ms  substeps " << substeps.at(i) << "  pressure " << solves.at(i).iterations
+                      << " iterations, residual " << solves.at(i).residual << std::endl;
+    }
+    double totalTime = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-totalStart).count();
+
+    std::vector<double> sorted {stepTimes};
+    std::sort(sorted.begin(),sorted.end());
+    double mean {std::accumulate(sorted.begin(),sorted.end(),0.0)/steps};
+    auto percentile = [&sorted](double p){ return sorted.at(static_cast<size_t>(p*(sorted.size()-1))); };
+
+    std::cout << "particles: " << sim.particles.size() << "  grid: " << sim.gridDimensions.x << "x" << sim.gridDimensions.y
+              << "  steps: " << steps << "  dt: " << dt
+              << "  threads: " << sim.numThreads() << (config.parallelPushApart || config.parallelTransfer?"":" (serial)") << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "step ms   min " << sorted.front() << "  mean " << mean << "  p50 " << percentile(0.5)
+              << "  p99 " << percentile(0.99) << "  max " << sorted.back() << std::endl;
+    std::cout << "total " << totalTime << " ms  (" << steps/(totalTime/1000.0) << " steps/s)" << std::endl;
+
+    double meanIterations {}, meanResidual {};
+    int maxIterations {};
+    float maxResidual {};
+    for(const pressureSolveResult &solve:solves){
+        meanIterations += solve.iterations;
+        meanResidual += solve.residual;
+        maxIterations = std::max(maxIterations,solve.iterations);
+        maxResidual = std::max(maxResidual,solve.residual);
+    }
+    std::cout << "pressure solve ("  << PRESSURE_SOLVER_NAMES[config.solver] << ")  iterations mean " << meanIterations/steps
+              << "  max " << maxIterations << "  residual mean " << meanResidual/steps << "  max " << maxResidual << std::endl;
+
+    std::cout << "substeps  mean " << std::accumulate(substeps.begin(),substeps.end(),0.0)/steps
+              << "  max " << *std::max_element(substeps.begin(),substeps.end()) << std::endl;
+
+    //per phase breakdown over the last PHASE_TIMER_WINDOW steps
+    if(PhaseTimings::enabled()){
+        std::cout << std::left << std::setw(22) << "phase ms" << std::right << std::setw(10) << "min"
+                  << std::setw(10) << "mean" << std::setw(10) << "p99" << std::endl;
+        for(int phase{};phase<NUM_PHASES;phase++){
+            phaseStats stats {sim.phaseTimings.stats(static_cast<simPhase>(phase))};
+            std::cout << std::left << std::setw(22) << PHASE_NAMES[phase] << std::right << std::setw(10) << stats.min
+                      << std::setw(10) << stats.mean << std::setw(10) << stats.p99 << std::endl;
+        }
+    }
+    return 0;
+}
@@ -1,10 +1,10 @@
 #version 450 core
 in vec2 uv;
+in vec3 vertexColor;
 out vec4 FragColor;
 
 //uniform sampler2D texture0;
 //uniform sampler2D texture1;
-uniform vec3 color;
 
 float circleSDF(vec2 pos){
     return length(pos)-0.5;
@@ -13,6 +13,6 @@ float circleSDF(vec2 pos){
 void main()
 {
     if(circleSDF(uv)>0) discard;
-    FragColor = vec4(color,1.0f);
+    FragColor = vec4(vertexColor,1.0f);
 }
 
@@ -6,6 +6,8 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <cstddef>
 
 class Shader
 {
@@ -39,6 +41,7 @@ public:
         glAttachShader(ID, fragmentID);
         glLinkProgram(ID);
         checkLinkingErrors();
+        cacheUniformLocations();
         
         //linked shaders can be deleted
         glDeleteShader(vertexID);
@@ -54,57 +57,84 @@ public:
         glDeleteProgram(ID);
     }
 
+    //location of an active uniform, -1 (which glUniform* ignores) if the program does not use it
+    int uniformLocation(const std::string &name) const{
+        auto found = uniformLocations.find(name);
+        return found == uniformLocations.end() ? -1 : found->second;
+    }
+
     // Methods for setting uniforms
     
     void setBool(const std::string &name, bool value) const{         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(uniformLocation(name), (int)value); 
     }
     
     void setInt(const std::string &name, int value) const{ 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(uniformLocation(name), value); 
     }
 
     void setFloat(const std::string &name, float value) const{ 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(uniformLocation(name), value); 
     }
 
     void setVec2(const std::string &name, const glm::vec2 &value) const{ 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2fv(uniformLocation(name), 1, &value[0]); 
     }
 
     void setVec2(const std::string &name, float x, float y) const{ 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(uniformLocation(name), x, y); 
     }
 
     void setVec3(const std::string &name, const glm::vec3 &value) const{ 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(uniformLocation(name), 1, &value[0]); 
     }
 
     void setVec3(const std::string &name, float x, float y, float z) const{ 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(uniformLocation(name), x, y, z); 
     }
 
     void setVec4(const std::string &name, const glm::vec4 &value) const{ 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(uniformLocation(name), 1, &value[0]); 
     }
 
     void setVec4(const std::string &name, float x, float y, float z, float w) const{ 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(uniformLocation(name), x, y, z, w); 
     }
 
     void setMat2(const std::string &name, const glm::mat2 &mat) const{
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+        glUniformMatrix2fv(uniformLocation(name), 1, GL_FALSE, glm::value_ptr(mat));
     }
 
     void setMat3(const std::string &name, const glm::mat3 &mat) const{
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+        glUniformMatrix3fv(uniformLocation(name), 1, GL_FALSE, glm::value_ptr(mat));
     }
 
     void setMat4(const std::string &name, const glm::mat4 &mat) const{
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
+        glUniformMatrix4fv(uniformLocation(name), 1, GL_FALSE, glm::value_ptr(mat));
     }
 
 private:
+    std::unordered_map<std::string,int> uniformLocations; //every active uniform, looked up once after linking
+
+    //uniforms in a block (see UniformBuffer) have no location and are skipped
+    void cacheUniformLocations(){
+        uniformLocations.clear();
+        int count, maxLength;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::string name(maxLength, '\0');
+        for(int i{};i<count;i++){
+            int length;
+            glGetActiveUniformName(ID, i, maxLength, &length, &name[0]);
+            std::string uniformName {name.substr(0,length)};
+            int location {glGetUniformLocation(ID, uniformName.c_str())};
+            if(location < 0) continue;
+            uniformLocations[uniformName] = location;
+            //arrays are reported as name[0], also allow setting the first element by the plain name
+            if(uniformName.size() > 3 && uniformName.compare(uniformName.size()-3,3,"[0]") == 0)
+                uniformLocations[uniformName.substr(0,uniformName.size()-3)] = location;
+        }
+    }
 
     std::string readSource(const char* path){
         std::ifstream sourceFile;
@@ -153,4 +183,28 @@ private:
         }
     }
 };
+
+//Buffer holding a std140 uniform block shared by several programs, each declares the block with
+//layout (std140, binding = N) and reads it once the buffer is bound to binding point N.
+class UniformBuffer
+{
+public:
+    unsigned int ID;
+    void create(std::size_t size, unsigned int binding){
+        glGenBuffers(1, &ID);
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+    }
+
+    //offset of a member follows the std140 rules, a mat4 takes 64 bytes
+    void setMat4(std::size_t offset, const glm::mat4 &mat) const{
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(glm::mat4), glm::value_ptr(mat));
+    }
+
+    void deleteBuffer(){
+        glDeleteBuffers(1, &ID);
+    }
+};
 #endif
\ No newline at end of file
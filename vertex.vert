@@ -1,12 +1,23 @@
 #version 450 core
 layout (location = 0) in vec3 aPos;
 //layout (location = 1) in vec2 TexCoord;
+layout (location = 1) in vec2 instancePos;   //per particle, only read when instanced
+layout (location = 2) in vec3 instanceColor; //per particle, only read when instanced
+layout (location = 3) in vec2 instancePrevPos; //per particle position before the last step, only read when instanced
 out vec2 uv;
+out vec3 vertexColor;
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140, binding = 0) uniform CameraMatrices { //shared by every program, filled once per frame
+    mat4 view;
+    mat4 projection;
+};
+uniform vec3 color;
+uniform bool instanced; //particles drawn in one call, offset by instancePos instead of model
+uniform float alpha; //how far instanced particles are drawn from instancePrevPos towards instancePos
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    vec4 worldPos = instanced ? vec4(aPos.xy + mix(instancePrevPos, instancePos, alpha), aPos.z, 1.0) : model * vec4(aPos, 1.0);
+    gl_Position = projection * view * worldPos;
     uv = aPos.xy;
+    vertexColor = instanced ? instanceColor : color;
 }
\ No newline at end of file